@@ -0,0 +1,57 @@
+#ifndef THIEFVKBENCHMARKDEVICE_HPP
+#define THIEFVKBENCHMARKDEVICE_HPP
+
+#include <vulkan/vulkan.hpp>
+
+#include <iostream>
+
+// A headless device with no surface or swap chain, enough to drive the memory
+// manager for real without opening a window.
+struct BenchmarkDevice {
+    vk::Instance       instance;
+    vk::PhysicalDevice physicalDevice;
+    vk::Device         device;
+};
+
+
+inline bool createBenchmarkDevice(BenchmarkDevice& benchmarkDevice) {
+    vk::ApplicationInfo appInfo{};
+    appInfo.setPApplicationName("ThiefVK benchmark");
+    appInfo.setPEngineName("ThiefVK");
+    appInfo.setApiVersion(VK_API_VERSION_1_1);
+
+    vk::InstanceCreateInfo instanceInfo{};
+    instanceInfo.setPApplicationInfo(&appInfo);
+    benchmarkDevice.instance = vk::createInstance(instanceInfo);
+
+    const std::vector<vk::PhysicalDevice> physicalDevices = benchmarkDevice.instance.enumeratePhysicalDevices();
+    if(physicalDevices.empty()) {
+        std::cerr << "No vulkan devices to run the benchmark on \n";
+        benchmarkDevice.instance.destroy();
+        return false;
+    }
+    benchmarkDevice.physicalDevice = physicalDevices[0];
+
+    const float queuePriority = 1.0f;
+    vk::DeviceQueueCreateInfo queueInfo{};
+    queueInfo.setQueueFamilyIndex(0);
+    queueInfo.setQueueCount(1);
+    queueInfo.setPQueuePriorities(&queuePriority);
+
+    vk::DeviceCreateInfo deviceInfo{};
+    deviceInfo.setQueueCreateInfoCount(1);
+    deviceInfo.setPQueueCreateInfos(&queueInfo);
+    benchmarkDevice.device = benchmarkDevice.physicalDevice.createDevice(deviceInfo);
+
+    std::cout << "Running on " << benchmarkDevice.physicalDevice.getProperties().deviceName << '\n';
+
+    return true;
+}
+
+
+inline void destroyBenchmarkDevice(BenchmarkDevice& benchmarkDevice) {
+    benchmarkDevice.device.destroy();
+    benchmarkDevice.instance.destroy();
+}
+
+#endif
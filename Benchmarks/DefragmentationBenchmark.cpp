@@ -0,0 +1,150 @@
+// Fragments a set of device local pools the way streaming textures in and out does,
+// then runs the same per frame defragmentation loop as ThiefVKDevice::defragmentDeviceMemory
+// against a real ThiefVKMemoryManager until it stops making progress. Reports how
+// many frames it took, what was moved and reclaimed, and the CPU cost per frame.
+// Only memory is moved, there are no images to copy so the GPU is never used.
+//
+// usage: DefragmentationBenchmark [bytes to move per frame]
+
+#include "BenchmarkDevice.hpp"
+#include "ThiefVKMemoryManager.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+
+    constexpr uint64_t kPoolSize        = 16 * 1000000;
+    constexpr uint64_t kBytesToAllocate = 8 * kPoolSize;
+    constexpr uint32_t kMaxFrames       = 10000;
+
+    struct BenchmarkAllocation {
+        Allocation alloc;
+        vk::MemoryRequirements requirements;
+    };
+
+
+    struct PoolSummary {
+        uint32_t pools;
+        uint64_t allocatedBytes;
+        float    averageFragmentation;
+    };
+
+
+    PoolSummary summarisePools(const ThiefVKMemoryManager& manager) {
+        ThiefVKMemoryStats stats;
+        manager.GetMemoryStats(stats);
+
+        PoolSummary summary{static_cast<uint32_t>(stats.pools.size()), 0, 0.0f};
+        for(const ThiefVKPoolStats& pool : stats.pools) {
+            summary.allocatedBytes += pool.size;
+            summary.averageFragmentation += pool.fragmentation;
+        }
+        if(!stats.pools.empty()) summary.averageFragmentation /= stats.pools.size();
+
+        return summary;
+    }
+
+
+    void printSummary(const char* name, const PoolSummary& summary) {
+        std::cout << name << summary.pools << " pools, " << summary.allocatedBytes << " bytes, average fragmentation " << summary.averageFragmentation << '\n';
+    }
+
+}
+
+
+int main(int argc, char** argv) {
+    const uint64_t bytesPerFrame = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 8 * 1000000;
+
+    BenchmarkDevice benchmarkDevice;
+    if(!createBenchmarkDevice(benchmarkDevice)) return 1;
+
+    ThiefVKMemoryManager manager{&benchmarkDevice.physicalDevice, &benchmarkDevice.device};
+
+    // small pools so there are plenty of them to pick sources from.
+    const vk::PhysicalDeviceMemoryProperties memoryProperties = benchmarkDevice.physicalDevice.getMemoryProperties();
+    uint32_t memoryTypeBits = 0;
+    for(uint32_t memoryType = 0; memoryType < memoryProperties.memoryTypeCount; ++memoryType) {
+        manager.SetPoolConfig(memoryType, {kPoolSize, kPoolSize, 1});
+        memoryTypeBits |= 1u << memoryType;
+    }
+
+    // Stream in textures from 64KB to 2MB, with the odd unmovable buffer
+    // mixed in, then unload three quarters of the textures.
+    std::mt19937_64 rng{42};
+    std::vector<BenchmarkAllocation> textures;
+    std::vector<Allocation> buffers;
+    for(uint64_t allocated = 0; allocated < kBytesToAllocate;) {
+        if(rng() % 32 == 0) {
+            buffers.push_back(manager.Allocate({1000000, 256, memoryTypeBits}, ThiefVKMemoryUsage::DeviceLocal));
+            allocated += 1000000;
+            continue;
+        }
+
+        const vk::MemoryRequirements requirements{uint64_t{64 * 1024} << (rng() % 6), 4096, memoryTypeBits};
+        textures.push_back({manager.Allocate(requirements, ThiefVKMemoryUsage::DeviceLocal, true), requirements});
+        allocated += requirements.size;
+    }
+
+    std::shuffle(textures.begin(), textures.end(), rng);
+    const size_t texturesKept = textures.size() / 4;
+    for(size_t i = texturesKept; i < textures.size(); ++i) {
+        manager.Free(textures[i].alloc);
+    }
+    textures.resize(texturesKept);
+
+    const PoolSummary before = summarisePools(manager);
+    printSummary("Before: ", before);
+
+    // the same loop ThiefVKDevice runs at the start of every frame.
+    uint32_t frames = 0;
+    uint32_t idleFrames = 0;
+    double slowestFrame = 0.0;
+    const auto start = std::chrono::steady_clock::now();
+    for(; frames < kMaxFrames && idleFrames < 10; ++frames) {
+        const auto frameStart = std::chrono::steady_clock::now();
+
+        manager.BeginDefragmentation();
+
+        uint64_t bytesMoved = 0;
+        for(BenchmarkAllocation& texture : textures) {
+            if(bytesMoved >= bytesPerFrame) break;
+            if(!manager.IsDefragmentationCandidate(texture.alloc)) continue;
+
+            const Allocation moved = manager.Reallocate(texture.alloc, texture.requirements);
+            if(moved.getSize() == 0) break; // no room in the other pools
+
+            manager.Free(texture.alloc); // nothing is in flight so the old memory can go straight away
+            texture.alloc = moved;
+            bytesMoved += texture.requirements.size;
+        }
+
+        manager.TrimPools();
+
+        const double frameTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - frameStart).count();
+        if(frameTime > slowestFrame) slowestFrame = frameTime;
+
+        idleFrames = bytesMoved == 0 ? idleFrames + 1 : 0;
+    }
+    const double totalTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    const PoolSummary after = summarisePools(manager);
+    printSummary("After:  ", after);
+
+    const ThiefVKDefragmentationStats stats = manager.GetDefragmentationStats();
+    std::cout << "Took " << frames - idleFrames << " frames moving at most " << bytesPerFrame << " bytes a frame \n"
+              << "Moved " << stats.allocationsMoved << " allocations, " << stats.bytesMoved << " bytes, reclaimed " << stats.bytesReclaimed << " bytes \n"
+              << "Average " << totalTime / frames << "us per frame, slowest " << slowestFrame << "us \n";
+
+    for(BenchmarkAllocation& texture : textures) manager.Free(texture.alloc);
+    for(Allocation& buffer : buffers) manager.Free(buffer);
+    manager.Destroy();
+
+    destroyBenchmarkDevice(benchmarkDevice);
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+// Hammers one ThiefVKMemoryManager from 1, 2, 4 and 8 threads at once. Each thread
+// keeps a working set of small allocations, the sort asset loading and per draw
+// buffers make, and randomly frees and replaces them. Reports the throughput for
+// each thread count and how well it scales over a single thread.
+//
+// usage: MemoryManagerStressBenchmark [operations per thread]
+
+#include "BenchmarkDevice.hpp"
+#include "ThiefVKMemoryManager.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    constexpr uint32_t kWorkingSetSize = 256; // live allocations per thread
+    constexpr uint32_t kThreadCounts[] = {1, 2, 4, 8};
+
+
+    // every 16th allocation is too big for the thread caches, so the global lock is still exercised.
+    uint64_t randomSize(std::mt19937_64& rng) {
+        if(rng() % 16 == 0) return uint64_t{128 * 1024} << (rng() % 4);
+
+        return 256 + rng() % (64 * 1024 - 256);
+    }
+
+
+    void stressThread(ThiefVKMemoryManager& manager, uint32_t memoryTypeBits, uint64_t operations, uint32_t seed) {
+        std::mt19937_64 rng{seed};
+        std::vector<Allocation> workingSet;
+        workingSet.reserve(kWorkingSetSize);
+
+        for(uint64_t op = 0; op < operations; ++op) {
+            if(workingSet.size() == kWorkingSetSize) {
+                const size_t victim = rng() % workingSet.size();
+                manager.Free(workingSet[victim]);
+                workingSet[victim] = workingSet.back();
+                workingSet.pop_back();
+            }
+
+            const vk::MemoryRequirements requirements{randomSize(rng), 256, memoryTypeBits};
+            const Allocation alloc = manager.Allocate(requirements, ThiefVKMemoryUsage::DeviceLocal);
+            if(alloc.getSize() != 0) workingSet.push_back(alloc);
+        }
+
+        for(Allocation& alloc : workingSet) manager.Free(alloc);
+    }
+
+}
+
+
+int main(int argc, char** argv) {
+    const uint64_t operationsPerThread = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+
+    BenchmarkDevice benchmarkDevice;
+    if(!createBenchmarkDevice(benchmarkDevice)) return 1;
+
+    const vk::PhysicalDeviceMemoryProperties memoryProperties = benchmarkDevice.physicalDevice.getMemoryProperties();
+    uint32_t memoryTypeBits = 0;
+    for(uint32_t memoryType = 0; memoryType < memoryProperties.memoryTypeCount; ++memoryType) memoryTypeBits |= 1u << memoryType;
+
+    std::cout << "CONCURRENT_MEMORY_MANAGER " << CONCURRENT_MEMORY_MANAGER << ", " << operationsPerThread << " operations per thread \n";
+
+    double singleThreadedRate = 0.0;
+    for(const uint32_t threadCount : kThreadCounts) {
+        // a fresh manager each time so earlier runs don't leave warm pools and caches behind.
+        ThiefVKMemoryManager manager{&benchmarkDevice.physicalDevice, &benchmarkDevice.device};
+
+        std::vector<std::thread> threads;
+        const auto start = std::chrono::steady_clock::now();
+        for(uint32_t thread = 0; thread < threadCount; ++thread) {
+            threads.emplace_back(stressThread, std::ref(manager), memoryTypeBits, operationsPerThread, thread + 1);
+        }
+        for(std::thread& thread : threads) thread.join();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        manager.Destroy();
+
+        const double rate = threadCount * operationsPerThread / seconds;
+        if(threadCount == 1) singleThreadedRate = rate;
+
+        std::cout << threadCount << " threads: " << rate / 1000000.0 << "M allocations a second, "
+                  << rate / singleThreadedRate << "x a single thread \n";
+    }
+
+    destroyBenchmarkDevice(benchmarkDevice);
+
+    return 0;
+}
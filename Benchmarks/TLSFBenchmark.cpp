@@ -0,0 +1,225 @@
+// Replays an allocation trace against ThiefVKTLSFAllocator and a first fit list
+// allocator like the one it replaced, and reports the CPU cost of each.
+//
+// usage: TLSFBenchmark [trace file]
+// A trace has one operation per line, either "a <id> <size> <allignment>" or "f <id>".
+// Without a trace a synthetic one is generated that looks like a scene being streamed
+// in: lots of small buffers with a few large textures, freed in a different order.
+
+#include "ThiefVKTLSFAllocator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+    constexpr uint64_t kPoolSize = 256 * 1000000;
+    constexpr uint32_t kTLSFReplays = 20;
+    constexpr uint32_t kFirstFitOps  = 20000; // it's slow enough that a prefix of the trace is plenty
+
+    struct TraceOp {
+        bool     allocate;
+        uint32_t id;
+        uint64_t size;
+        uint64_t allignment;
+    };
+
+
+    std::vector<TraceOp> loadTrace(const std::string& path) {
+        std::vector<TraceOp> trace;
+        std::ifstream file{path};
+
+        char op;
+        while(file >> op) {
+            TraceOp traceOp{op == 'a', 0, 0, 1};
+            file >> traceOp.id;
+            if(traceOp.allocate) file >> traceOp.size >> traceOp.allignment;
+
+            trace.push_back(traceOp);
+        }
+
+        return trace;
+    }
+
+
+    std::vector<TraceOp> generateTrace(const uint32_t opCount) {
+        std::mt19937_64 rng{42};
+        std::vector<TraceOp> trace;
+        std::vector<uint32_t> live;
+        uint32_t nextID = 0;
+
+        for(uint32_t i = 0; i < opCount; ++i) {
+            // keep roughly a couple of thousand allocations alive.
+            if(live.empty() || rng() % 4096 > live.size()) {
+                TraceOp op{true, nextID++, 0, 256};
+                if(rng() % 64 == 0) {
+                    op.size = (64 * 1024) << (rng() % 8); // texture, 64KB to 8MB
+                    op.allignment = 4096;
+                } else {
+                    op.size = 64 + rng() % (64 * 1024); // vertex, index and uniform buffers
+                }
+
+                live.push_back(op.id);
+                trace.push_back(op);
+            } else {
+                const size_t index = rng() % live.size();
+                trace.push_back({false, live[index], 0, 0});
+
+                live[index] = live.back();
+                live.pop_back();
+            }
+        }
+
+        for(const uint32_t id : live) trace.push_back({false, id, 0, 0});
+
+        return trace;
+    }
+
+
+    // First fit over a std::list of fragments, alligning a byte at a time.
+    class FirstFitAllocator {
+    public:
+        explicit FirstFitAllocator(uint64_t size) : mFragments{{0, size, true}} {}
+
+        bool allocate(uint64_t size, uint64_t allignment, uint64_t& offset) {
+            for(auto fragment = mFragments.begin(); fragment != mFragments.end(); ++fragment) {
+                if(!fragment->free) continue;
+
+                uint64_t allignedOffset = fragment->offset;
+                while(allignedOffset % allignment != 0) ++allignedOffset;
+                if(allignedOffset + size > fragment->offset + fragment->size) continue;
+
+                const uint64_t end = fragment->offset + fragment->size;
+                if(allignedOffset != fragment->offset) {
+                    mFragments.insert(fragment, {fragment->offset, allignedOffset - fragment->offset, true});
+                }
+                fragment->offset = allignedOffset;
+                fragment->size = size;
+                fragment->free = false;
+                if(allignedOffset + size != end) {
+                    mFragments.insert(std::next(fragment), {allignedOffset + size, end - allignedOffset - size, true});
+                }
+
+                offset = allignedOffset;
+                return true;
+            }
+
+            return false;
+        }
+
+        void free(uint64_t offset) {
+            for(auto fragment = mFragments.begin(); fragment != mFragments.end(); ++fragment) {
+                if(fragment->offset != offset || fragment->free) continue;
+
+                fragment->free = true;
+                auto next = std::next(fragment);
+                if(next != mFragments.end() && next->free) {
+                    fragment->size += next->size;
+                    mFragments.erase(next);
+                }
+                if(fragment != mFragments.begin() && std::prev(fragment)->free) {
+                    auto prev = std::prev(fragment);
+                    prev->size += fragment->size;
+                    mFragments.erase(fragment);
+                }
+                return;
+            }
+        }
+
+    private:
+        struct Fragment {
+            uint64_t offset;
+            uint64_t size;
+            bool free;
+        };
+
+        std::list<Fragment> mFragments;
+    };
+
+
+    struct ReplayResult {
+        double   nanoSecondsPerOp;
+        uint32_t failedAllocations;
+    };
+
+
+    ReplayResult replayTLSF(const std::vector<TraceOp>& trace, uint32_t maxID, ThiefVKTLSFAllocator& allocator) {
+        std::vector<uint32_t> blocks(maxID + 1, ThiefVKTLSFAllocator::kInvalidBlock);
+        uint32_t failed = 0;
+
+        const auto start = std::chrono::steady_clock::now();
+        for(uint32_t replay = 0; replay < kTLSFReplays; ++replay) {
+            for(const TraceOp& op : trace) {
+                if(op.allocate) {
+                    const TLSFAllocation alloc = allocator.allocate(op.size, op.allignment);
+                    if(alloc.size == 0) ++failed;
+                    blocks[op.id] = alloc.block;
+                } else if(blocks[op.id] != ThiefVKTLSFAllocator::kInvalidBlock) {
+                    allocator.free(blocks[op.id]);
+                    blocks[op.id] = ThiefVKTLSFAllocator::kInvalidBlock;
+                }
+            }
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        return {std::chrono::duration<double, std::nano>(end - start).count() / (double(trace.size()) * kTLSFReplays), failed};
+    }
+
+
+    ReplayResult replayFirstFit(const std::vector<TraceOp>& trace, uint32_t maxID) {
+        FirstFitAllocator allocator{kPoolSize};
+        std::vector<uint64_t> offsets(maxID + 1);
+        std::vector<bool> allocated(maxID + 1, false);
+        uint32_t failed = 0;
+
+        const auto start = std::chrono::steady_clock::now();
+        const size_t opCount = std::min<size_t>(trace.size(), kFirstFitOps);
+        for(size_t i = 0; i < opCount; ++i) {
+            const TraceOp& op = trace[i];
+            if(op.allocate) {
+                allocated[op.id] = allocator.allocate(op.size, op.allignment, offsets[op.id]);
+                if(!allocated[op.id]) ++failed;
+            } else if(allocated[op.id]) {
+                allocator.free(offsets[op.id]);
+                allocated[op.id] = false;
+            }
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        return {std::chrono::duration<double, std::nano>(end - start).count() / double(opCount), failed};
+    }
+
+}
+
+
+int main(int argc, char** argv) {
+    const std::vector<TraceOp> trace = argc > 1 ? loadTrace(argv[1]) : generateTrace(100000);
+    if(trace.empty()) {
+        std::cerr << "Empty trace \n";
+        return 1;
+    }
+
+    uint32_t maxID = 0;
+    for(const TraceOp& op : trace) maxID = std::max(maxID, op.id);
+
+    std::cout << "Replaying " << trace.size() << " operations in to a " << kPoolSize << " byte pool \n";
+
+    ThiefVKTLSFAllocator tlsf{kPoolSize};
+    const ReplayResult tlsfResult = replayTLSF(trace, maxID, tlsf);
+    std::cout << "TLSF:      " << tlsfResult.nanoSecondsPerOp << " ns/op, " << tlsfResult.failedAllocations << " failed allocations, "
+              << tlsf.getFreeBlockCount() << " free blocks left \n";
+
+    const ReplayResult firstFitResult = replayFirstFit(trace, maxID);
+    std::cout << "First fit: " << firstFitResult.nanoSecondsPerOp << " ns/op over the first " << std::min<size_t>(trace.size(), kFirstFitOps) << " operations, "
+              << firstFitResult.failedAllocations << " failed allocations \n";
+
+    return 0;
+}
@@ -8,8 +8,6 @@ layout(binding = 0) uniform UniformBufferObject {
 } ubo;
 
 layout(location = 0) in vec3 fragPos;
-layout(location = 1) in vec2 inText;
-layout(location = 2) in vec3 inNorm;
 layout(location = 3) in float inAlbedo;
 
 layout(location = 0) out float Albedo;
@@ -0,0 +1,18 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec2 texCoord;
+
+layout(location = 0) out vec4 outColor;
+
+// every resident texture, has to match kMaxBindlessTextures.
+layout(set = 1, binding = 0) uniform sampler2D textures[4096];
+
+layout(push_constant) uniform DrawConstants {
+    uint textureIndex;
+} draw;
+
+
+void main() {
+    outColor = texture(textures[draw.textureIndex], texCoord);
+}
@@ -11,10 +11,10 @@ layout(binding = 0) uniform UniformBufferObject {
     Light spotLights[10];
 } ubo;
 
-layout(binding = 1) uniform sampler2D colourTexture;
-layout(binding = 2) uniform sampler2D depthTexture;
-layout(binding = 3) uniform sampler2D normalstexture;
-layout(binding = 4) uniform sampler2D albedoTexture;
+layout(input_attachment_index = 0, binding = 1) uniform subpassInput colourTexture;
+layout(input_attachment_index = 1, binding = 2) uniform subpassInput depthTexture;
+layout(input_attachment_index = 2, binding = 3) uniform subpassInput normalstexture;
+layout(input_attachment_index = 3, binding = 4) uniform subpassInput albedoTexture;
 
 layout (push_constant) uniform pushConstants {
 	vec4 LightAndInvView[5];
@@ -26,10 +26,10 @@ layout(location = 1) in vec2 texCoords;
 
 void main()
 {             
-    vec3 FragPos = (texture(albedoTexture, texCoords).xyz * 2.0f) - 1.0f;
-    vec3 Normal = (texture(normalstexture, texCoords).xyz * 2.0f) - 1.0f;
-    vec3 Albedo = vec3(texture(albedoTexture, texCoords).w);
-    frameBuffer = texture(colourTexture, texCoords);
+    vec3 FragPos = (subpassLoad(albedoTexture).xyz * 2.0f) - 1.0f;
+    vec3 Normal = (subpassLoad(normalstexture).xyz * 2.0f) - 1.0f;
+    vec3 Albedo = vec3(subpassLoad(albedoTexture).w);
+    frameBuffer = subpassLoad(colourTexture);
     
     // then calculate lighting as usual
     vec3 lighting = Albedo * 0.1; // hard-coded ambient component
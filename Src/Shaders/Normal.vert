@@ -8,12 +8,23 @@ layout(binding = 0) uniform UniformBufferObject {
 } ubo;
 
 layout(location = 0) in vec3 fragPos;
-layout(location = 1) in vec2 inText;
 layout(location = 2) in vec3 inNorm;
-layout(location = 3) in float albedo;
 
 layout(location = 0) out vec3 Norms;
 
+// set when the mesh uses compact vertices, inNorm.xy is then an octahedral encoded normal.
+layout(constant_id = 0) const bool kOctahedralNormals = false;
+
+vec3 decodeNormal(vec3 norm) {
+        if(!kOctahedralNormals) return norm;
+
+        vec3 decoded = vec3(norm.xy, 1.0 - abs(norm.x) - abs(norm.y));
+        if(decoded.z < 0.0) {
+                decoded.xy = (1.0 - abs(decoded.yx)) * vec2(decoded.x >= 0.0 ? 1.0 : -1.0, decoded.y >= 0.0 ? 1.0 : -1.0);
+        }
+        return normalize(decoded);
+}
+
 out gl_PerVertex {
     vec4 gl_Position;
 };
@@ -21,5 +32,5 @@ out gl_PerVertex {
 
 void main() {
         gl_Position = ubo.proj * ubo.view * ubo.model * vec4(fragPos, 1.0);
-        Norms = (ubo.proj * ubo.view * ubo.model * vec4(inNorm, 0.0)).xyz;
+        Norms = (ubo.proj * ubo.view * ubo.model * vec4(decodeNormal(inNorm), 0.0)).xyz;
 }
@@ -5,72 +5,104 @@
 #include "ThiefVKDevice.hpp"
 #include "ThiefVKVertex.hpp"
 #include "ThiefVKModel.hpp"
+#include "ThiefVKHash.hpp"
 
 #include <iostream>
 #include <numeric>
+#include <cstring>
 
 template<typename T>
-ThiefVKBufferManager<T>::ThiefVKBufferManager(ThiefVKDevice &Device, vk::BufferUsageFlags usage, uint64_t allignment) : mDevice{Device}, mUsage{usage}, mAllignment{allignment}, mCurrentOffset{0ul} {}
+ThiefVKBufferManager<T>::ThiefVKBufferManager(ThiefVKDevice &Device, vk::BufferUsageFlags usage, uint64_t allignment) : mDevice{Device}, mUsage{usage}, mAllignment{allignment}, mCurrentOffset{0ul}, mDeviceBuffer{} {}
 
 
+// The elements are only read twice, once to hash them and once (if they changed) to
+// write them to staging memory, there is no CPU side copy of the buffer.
 template<typename T>
 void ThiefVKBufferManager<T>::addBufferElements(const std::vector<T> &elements) {
 	mRealAllignment = std::ceil(float(sizeof(T) * elements.size()) / float(mAllignment)) * mAllignment;
 
 	uint32_t offset = mCurrentOffset;
-	mEntries.push_back({offset, elements.size(), mRealAllignment});
+	const uint64_t hash = ThiefVKHashBytes(elements.data(), sizeof(T) * elements.size());
+	mEntries.push_back({offset, elements.size(), mRealAllignment, hash});
 
 	mCurrentOffset += mRealAllignment;
 
-	mBuffer.insert(mBuffer.end(), elements.begin(), elements.end());
+	if(elements.empty() || entryIsClean(mEntries.size() - 1)) return;
 
+	const uint64_t elementsSize = sizeof(T) * elements.size();
+	ThiefVKRingAllocation stagingMemory = mDevice.getStagingMemory(elementsSize);
+	std::memcpy(stagingMemory.mMappedPointer, elements.data(), elementsSize);
+
+	// entries are added in order, so extend the last copy if both sides are contiguous.
+	if(!mPendingCopies.empty()) {
+		auto& [lastBuffer, lastCopy] = mPendingCopies.back();
+		if(lastBuffer == stagingMemory.mBuffer && lastCopy.srcOffset + lastCopy.size == stagingMemory.mOffset && lastCopy.dstOffset + lastCopy.size == offset) {
+			lastCopy.size += elementsSize;
+			return;
+		}
+	}
+
+	mPendingCopies.push_back({stagingMemory.mBuffer, vk::BufferCopy{stagingMemory.mOffset, offset, elementsSize}});
 }
 
 
+// An entry is clean if it's data is already at the same place in the device buffer.
 template<typename T>
-std::pair<ThiefVKBuffer, ThiefVKBuffer> ThiefVKBufferManager<T>::uploadBuffer(ThiefVKBuffer& buffer, const uint64_t bufferSize) {
-	ThiefVKBuffer stagingBuffer{};
+bool ThiefVKBufferManager<T>::entryIsClean(const uint32_t index) const {
+	if(mDeviceBuffer.mBuffer == vk::Buffer(nullptr) || index >= mPreviousEntries.size()) return false;
 
-	stagingBuffer = mDevice.createBuffer(vk::BufferUsageFlagBits::eTransferSrc, bufferSize);
+	const entryInfo& entry = mEntries[index];
+	const entryInfo& previousEntry = mPreviousEntries[index];
 
-	std::unique_ptr<char[]> allignedData(new char[bufferSize]);
-	uint64_t bufferPos = 0;
-	for(unsigned int i = 0; i < mEntries.size(); ++i) {
-		std::memmove(allignedData.get() + mEntries[i].offset, &mBuffer[bufferPos], mEntries[i].numberOfEntries * sizeof(T));
-		bufferPos += mEntries[i].numberOfEntries;
-	}
+	return entry.offset == previousEntry.offset && entry.numberOfEntries == previousEntry.numberOfEntries && entry.hash == previousEntry.hash;
+}
 
-	void* memory = mDevice.getMemoryManager()->MapAllocation(stagingBuffer.mBufferMemory);
-	memcpy(memory, allignedData.get(), bufferSize);
-	mDevice.getMemoryManager()->UnMapAllocation(stagingBuffer.mBufferMemory);
 
-	mDevice.copyBuffers(stagingBuffer.mBuffer, buffer.mBuffer, bufferSize);
+template<typename T>
+ThiefVKBuffer ThiefVKBufferManager<T>::flushBufferUploads() {
+	const uint64_t bufferSize = mCurrentOffset;
 
-	mPreviousBuffer = mBuffer;
-	mPreviousDeviceBuffer = buffer;
-	mBuffer.clear();
-	mEntries.clear();
-	mCurrentOffset = 0;
+	if(bufferSize > mDeviceBuffer.mSize) {
+		// clean entries were never staged, they're still in the old buffer at the same offset.
+		std::vector<vk::BufferCopy> cleanRegions;
+		for(uint32_t i = 0; i < mEntries.size(); ++i) {
+			if(mEntries[i].numberOfEntries == 0 || !entryIsClean(i)) continue;
 
-	return {buffer, stagingBuffer};
-}
+			cleanRegions.push_back({mDeviceBuffer.mOffset + mEntries[i].offset, mEntries[i].offset, mEntries[i].numberOfEntries * sizeof(T)});
+		}
 
+		// leave some room so a slowly growing buffer isn't recreated every frame.
+		ThiefVKBuffer oldBuffer = mDeviceBuffer;
+		mDeviceBuffer = mDevice.createBuffer(vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst | mUsage, bufferSize + bufferSize / 2);
 
-template<typename T>
-std::pair<ThiefVKBuffer, ThiefVKBuffer> ThiefVKBufferManager<T>::flushBufferUploads() {
-	if(!bufferHasChanged()) {
-		mBuffer.clear();
-		mEntries.clear();
-		mCurrentOffset = 0;
-		return {mPreviousDeviceBuffer, ThiefVKBuffer{}};
+		if(!cleanRegions.empty()) {
+			for(auto& region : cleanRegions) region.dstOffset += mDeviceBuffer.mOffset;
+			mDevice.copyBufferRegions(oldBuffer.mBuffer, mDeviceBuffer.mBuffer, cleanRegions, mUsage);
+		}
+
+		mDevice.destroyBuffer(oldBuffer); // frames in flight may still be using it
 	}
 
-	const uint64_t bufferSize = std::accumulate(mEntries.begin(), mEntries.end(), 0, [](const int& lhs, const entryInfo& rhs) { return lhs + rhs.entrySize; } );
+	// the staging regions are nearly always in the ring buffer, so this is normally a single copy.
+	std::vector<vk::BufferCopy> regions;
+	for(uint32_t i = 0; i < mPendingCopies.size(); ++i) {
+		vk::BufferCopy region = mPendingCopies[i].second;
+		region.dstOffset += mDeviceBuffer.mOffset;
+		regions.push_back(region);
+
+		if(i + 1 == mPendingCopies.size() || mPendingCopies[i + 1].first != mPendingCopies[i].first) {
+			mDevice.copyBufferRegions(mPendingCopies[i].first, mDeviceBuffer.mBuffer, regions, mUsage);
+			regions.clear();
+		}
+	}
+	mPendingCopies.clear();
 
-	ThiefVKBuffer buffer = mDevice.createBuffer(vk::BufferUsageFlagBits::eTransferDst | mUsage, bufferSize);
+	// only the entries (and their hashes) need to be kept to diff against next frame.
+	mPreviousEntries.swap(mEntries);
+	mEntries.clear();
+	mCurrentOffset = 0;
 
-	// Upload the current buffer
-	return uploadBuffer(buffer, bufferSize);
+	return mDeviceBuffer;
 }
 
 
@@ -82,7 +114,14 @@ std::vector<entryInfo> ThiefVKBufferManager<T>::getBufferOffsets() {
 
 template<typename T>
 bool ThiefVKBufferManager<T>::bufferHasChanged() const {
-	return mPreviousBuffer != mBuffer;
+	return !mPendingCopies.empty() || mCurrentOffset > mDeviceBuffer.mSize;
+}
+
+
+template<typename T>
+void ThiefVKBufferManager<T>::destroy() {
+	mDevice.destroyBuffer(mDeviceBuffer);
+	mDeviceBuffer = ThiefVKBuffer{};
 }
 
 // we need to explicitly instansiate what buffer managers we will be using here
@@ -16,8 +16,13 @@ struct entryInfo {
 	uint32_t offset;
 	uint64_t numberOfEntries;
 	uint64_t entrySize;
+	uint64_t hash; // of the entries elements, used to find out what changed between frames.
 };
 
+// Gathers up elements each frame and keeps them in one device buffer. Entries whose
+// hash changed since the last frame are written straight in to mapped staging memory
+// as they're added, so addBufferElements must be called between startFrame and endFrame.
+// The device buffer is kept between frames and only recreated when it needs to grow.
 template<typename T>
 class ThiefVKBufferManager {
 public:
@@ -26,13 +31,15 @@ public:
 
 	void addBufferElements(const std::vector<T>& elements);
 
-	std::pair<ThiefVKBuffer, ThiefVKBuffer> flushBufferUploads();
+	ThiefVKBuffer flushBufferUploads();
 	std::vector<entryInfo> getBufferOffsets();
 
 	bool bufferHasChanged() const;
 
+	void destroy();
+
 private:
-	std::pair<ThiefVKBuffer, ThiefVKBuffer> uploadBuffer(ThiefVKBuffer&, const uint64_t);
+	bool entryIsClean(const uint32_t index) const;
 
 	ThiefVKDevice& mDevice;
 
@@ -40,12 +47,14 @@ private:
 	uint64_t mAllignment;
 	uint64_t mRealAllignment;
 
-	std::vector<T> mBuffer;
 	std::vector<entryInfo> mEntries;
 	uint64_t mCurrentOffset;
 
-	std::vector<T> mPreviousBuffer;
-	ThiefVKBuffer mPreviousDeviceBuffer;
+	std::vector<entryInfo> mPreviousEntries;
+	ThiefVKBuffer mDeviceBuffer;
+
+	// copies from staging memory for the entries that changed, regions are relative to the device buffer.
+	std::vector<std::pair<vk::Buffer, vk::BufferCopy>> mPendingCopies;
 };
 
 #endif
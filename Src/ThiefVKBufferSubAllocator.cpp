@@ -0,0 +1,101 @@
+#include "ThiefVKBufferSubAllocator.hpp"
+
+#include "ThiefVKDevice.hpp"
+
+#include <iostream>
+
+
+ThiefVKBufferSubAllocator::ThiefVKBufferSubAllocator(ThiefVKDevice& Device, vk::BufferUsageFlags usage, ThiefVKMemoryUsage memoryUsage, uint64_t allignment, uint64_t blockSize) :
+    mDevice{Device},
+    mUsage{usage},
+    mMemoryUsage{memoryUsage},
+    mAllignment{allignment},
+    mBlockSize{blockSize} {}
+
+
+bool ThiefVKBufferSubAllocator::allocateBlock(uint32_t& block) {
+    ThiefVKBuffer buffer = mDevice.createDedicatedBuffer(mUsage, mBlockSize, mMemoryUsage);
+    if(buffer.mBuffer == vk::Buffer(nullptr)) return false;
+
+    ++mLiveBlocks;
+
+    for(block = 0; block < mBlocks.size(); ++block) {
+        if(isBlockLive(block)) continue;
+
+        mBlocks[block] = buffer;
+        mAllocators[block] = ThiefVKTLSFAllocator(mBlockSize);
+        return true;
+    }
+
+    mBlocks.push_back(buffer);
+    mAllocators.emplace_back(mBlockSize);
+
+#ifndef NDEBUG
+    std::cerr << "Allocated a new shared buffer of size " << mBlockSize << '\n';
+#endif
+
+    return true;
+}
+
+
+ThiefVKBuffer ThiefVKBufferSubAllocator::allocate(uint64_t size) {
+    const auto subAllocate = [this, size](uint32_t block) {
+        const TLSFAllocation slice = mAllocators[block].allocate(size, mAllignment);
+        if(slice.size == 0) return ThiefVKBuffer{};
+
+        ThiefVKBuffer buffer = mBlocks[block];
+        buffer.mOffset = slice.offset;
+        buffer.mSize = slice.size;
+        buffer.mSubAllocator = this;
+        buffer.mSharedBufferIndex = block;
+        buffer.mSubAllocationBlock = slice.block;
+
+        return buffer;
+    };
+
+    for(uint32_t i = 0; i < mBlocks.size(); ++i) {
+        if(!isBlockLive(i)) continue;
+
+        const ThiefVKBuffer buffer = subAllocate(i);
+        if(buffer.mBuffer != vk::Buffer(nullptr)) return buffer;
+    }
+
+    uint32_t newBlock;
+    if(allocateBlock(newBlock)) {
+        const ThiefVKBuffer buffer = subAllocate(newBlock);
+        if(buffer.mBuffer != vk::Buffer(nullptr)) return buffer;
+    }
+
+    std::cerr << "Failed to sub allocate a buffer of size " << size << '\n';
+    return ThiefVKBuffer{};
+}
+
+
+void ThiefVKBufferSubAllocator::free(const ThiefVKBuffer& buffer) {
+    const uint32_t block = buffer.mSharedBufferIndex;
+    mAllocators[block].free(buffer.mSubAllocationBlock);
+
+    // Slices are only freed once the frames using them have finished, so an empty block
+    // isn't in use by the GPU and can go straight away. Keep the last one around so a
+    // steady trickle of buffers doesn't create and destroy a block every time.
+    if(mAllocators[block].getAllocationCount() != 0 || mLiveBlocks == 1) return;
+
+    mDevice.DestroyBufferInternal(mBlocks[block]);
+    mBlocks[block] = ThiefVKBuffer{};
+    mAllocators[block] = ThiefVKTLSFAllocator{};
+    --mLiveBlocks;
+
+#ifndef NDEBUG
+    std::cerr << "Released a shared buffer of size " << mBlockSize << '\n';
+#endif
+}
+
+
+void ThiefVKBufferSubAllocator::destroy() {
+    for(uint32_t i = 0; i < mBlocks.size(); ++i) {
+        if(isBlockLive(i)) mDevice.destroyBuffer(mBlocks[i]);
+    }
+    mBlocks.clear();
+    mAllocators.clear();
+    mLiveBlocks = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef THIEFVKBUFFERSUBALLOCATOR_HPP
+#define THIEFVKBUFFERSUBALLOCATOR_HPP
+
+#include <vulkan/vulkan.hpp>
+
+#include <vector>
+
+#include "ThiefVKMemoryManager.hpp"
+#include "ThiefVKTLSFAllocator.hpp"
+
+class ThiefVKDevice;
+
+// Hands out (buffer, offset, size) slices of a few large buffers that all have the
+// same usage and memory usage. This means short lived buffers don't each need their
+// own vk::Buffer and bound memory, and consecutive binds can reuse the same handle
+// with a different offset. Each large buffer is carved up by a TLSF allocator, and
+// released again once nothing is using it, unless it's the last one.
+class ThiefVKBufferSubAllocator {
+public:
+    ThiefVKBufferSubAllocator(ThiefVKDevice& Device, vk::BufferUsageFlags usage, ThiefVKMemoryUsage memoryUsage, uint64_t allignment, uint64_t blockSize);
+
+    // returns a buffer with a null handle on failure
+    ThiefVKBuffer allocate(uint64_t size);
+    void          free(const ThiefVKBuffer&);
+
+    void destroy();
+
+private:
+    bool allocateBlock(uint32_t& block); // might reuse the slot of a released block
+    bool isBlockLive(uint32_t block) const { return mAllocators[block].getSize() != 0; }
+
+    ThiefVKDevice& mDevice;
+
+    vk::BufferUsageFlags mUsage;
+    ThiefVKMemoryUsage   mMemoryUsage;
+    uint64_t mAllignment;
+    uint64_t mBlockSize;
+
+    // released blocks are left in place with a size of 0 so the indicies in slices stay valid.
+    std::vector<ThiefVKBuffer>        mBlocks;
+    std::vector<ThiefVKTLSFAllocator> mAllocators;
+    uint32_t mLiveBlocks = 0;
+};
+
+#endif
@@ -1,28 +1,55 @@
 #include "ThiefVKDescriptorManager.hpp"
 #include "ThiefVKDevice.hpp"
+#include "ThiefVKHash.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
-bool operator<(const ThiefVKDescriptorDescription& lhs, const ThiefVKDescriptorDescription& rhs) {
-	return static_cast<int>(lhs.mDescriptor.mDescType) < static_cast<int>(rhs.mDescriptor.mDescType) &&
-		lhs.mDescriptor.mBinding < rhs.mDescriptor.mBinding;
+bool operator==(const ThiefVKDescriptor& lhs, const ThiefVKDescriptor& rhs) {
+	return lhs.mDescType == rhs.mDescType && lhs.mShaderStage == rhs.mShaderStage && lhs.mBinding == rhs.mBinding;
 }
 
 
-ThiefVKDescriptorManager::ThiefVKDescriptorManager(ThiefVKDevice& device) : mDev{ device } {
+bool operator==(const ThiefVKBoundResource& lhs, const ThiefVKBoundResource& rhs) {
+	return lhs.mImageView == rhs.mImageView && lhs.mBuffer == rhs.mBuffer && lhs.mOffset == rhs.mOffset && lhs.mSize == rhs.mSize;
+}
+
+
+uint64_t hashDescriptorSetLayout(const ThiefVKDescriptorSetDescription& description) {
+	uint64_t hash = 0;
+	for(const auto& desc : description) {
+		const uint32_t fields[3] = {static_cast<uint32_t>(desc.mDescriptor.mDescType), static_cast<uint32_t>(desc.mDescriptor.mShaderStage), desc.mDescriptor.mBinding};
+		hash = ThiefVKHashBytes(fields, sizeof(fields), hash);
+	}
+
+	return hash;
+}
+
+
+bool operator==(const ThiefVKDescriptorSetLayoutKey& lhs, const ThiefVKDescriptorSetLayoutKey& rhs) {
+	return lhs.mHash == rhs.mHash && lhs.mDescriptors == rhs.mDescriptors;
+}
+
+
+ThiefVKDescriptorManager::ThiefVKDescriptorManager(ThiefVKDevice& device) : mDev{ device }, mUpdateTemplatesSupported{ false } {
+#ifdef VK_API_VERSION_1_1
+	mUpdateTemplatesSupported = mDev.getPhysicalDevice()->getProperties().apiVersion >= VK_API_VERSION_1_1;
+#endif
+
 	// allocate the initial pool.
 	mPools.push_back(allocateNewPool());
 }
 
 
 void ThiefVKDescriptorManager::Destroy() {
-	for(auto& [key, descriptorSet] : mFreeCache) {
-		mDev.getLogicalDevice()->destroyDescriptorSetLayout(descriptorSet.first);
-		for(auto& descriptor : descriptorSet.second) {
-			for(auto& sampler : descriptor.mSamplers) {
-				mDev.destroySampler(sampler);
-			}
-		}
+	for(auto& [key, entry] : mLayoutCache) {
+		mDev.getLogicalDevice()->destroyDescriptorSetLayout(entry.mLayout);
+		if(entry.mUpdateTemplate != vk::DescriptorUpdateTemplate(nullptr))
+			mDev.getLogicalDevice()->destroyDescriptorUpdateTemplate(entry.mUpdateTemplate);
 	}
 	for (auto& pool : mPools) {
 		mDev.getLogicalDevice()->destroyDescriptorPool(pool);
@@ -30,58 +57,75 @@ void ThiefVKDescriptorManager::Destroy() {
 }
 
 
+ThiefVKDescriptorManager::LayoutCacheEntry& ThiefVKDescriptorManager::getCacheEntry(const ThiefVKDescriptorSetDescription& description) {
+	mLookupKey.mDescriptors.clear();
+	for(const auto& desc : description) {
+		mLookupKey.mDescriptors.push_back(desc.mDescriptor);
+	}
+	mLookupKey.mHash = hashDescriptorSetLayout(description);
+
+	auto entry = mLayoutCache.find(mLookupKey);
+	if(entry == mLayoutCache.end()) {
+		LayoutCacheEntry newEntry{};
+		newEntry.mLayout = createDescriptorSetLayout(description);
+		newEntry.mUpdateTemplate = createUpdateTemplate(description, newEntry.mLayout);
+
+		entry = mLayoutCache.emplace(mLookupKey, std::move(newEntry)).first;
+	}
+
+	return entry->second;
+}
+
+
 ThiefVKDescriptorSet ThiefVKDescriptorManager::getDescriptorSet(const ThiefVKDescriptorSetDescription& description) {
+	LayoutCacheEntry& entry = getCacheEntry(description);
+	const uint64_t boundResourcesHash = hashBoundResources(description);
+
+	// prefer a free set last written with the same resources, otherwise any free set will do.
+	auto freeSet = entry.mFreeSets.find(boundResourcesHash);
+	if(freeSet == entry.mFreeSets.end()) freeSet = entry.mFreeSets.begin();
+
 	ThiefVKDescriptorSet set{};
-	
-	if (!mFreeCache[description].second.empty()) {
-		set = mFreeCache[description].second.back();
+
+	if(freeSet != entry.mFreeSets.end()) {
+		set = std::move(freeSet->second);
 		set.mDesc = description;
 
-		mFreeCache[description].second.pop_back();
+		entry.mFreeSets.erase(freeSet);
 	} else {
-		set = createDescriptorSet(description);
+		set = createDescriptorSet(description, entry);
 	}
 
-	writeDescriptorSet(set);
+	// a set that still points at the same resources can be used without writing it.
+	if(set.mWriteGeneration == mWriteGeneration && set.mBoundResourcesHash == boundResourcesHash && boundResourcesMatch(set)) return set;
+
+	writeDescriptorSet(set, entry);
+
+	for(uint32_t i = 0; i < description.size(); ++i) {
+		set.mBoundResources[i] = getBoundResource(description[i]);
+	}
+	set.mBoundResourcesHash = boundResourcesHash;
+	set.mWriteGeneration = mWriteGeneration;
 	
 	return set;
 }
 
 
-ThiefVKDescriptorSet ThiefVKDescriptorManager::createDescriptorSet(const ThiefVKDescriptorSetDescription& description) {
-	vk::DescriptorSetLayout layout;
-
-	if (mFreeCache[description].first != vk::DescriptorSetLayout(nullptr)) {
-		layout = mFreeCache[description].first;
-	} 
-	else {
-		layout = createDescriptorSetLayout(description);
-		mFreeCache[description].first = layout;
-	}
+ThiefVKDescriptorSet ThiefVKDescriptorManager::createDescriptorSet(const ThiefVKDescriptorSetDescription& description, LayoutCacheEntry& entry) {
 	for (;;) {
 		for (auto& pool : mPools) {
 			vk::DescriptorSetAllocateInfo allocInfo{};
 			allocInfo.setDescriptorPool(pool);
 			allocInfo.setDescriptorSetCount(1);
-			allocInfo.setPSetLayouts(&layout);
+			allocInfo.setPSetLayouts(&entry.mLayout);
 
-			std::vector<vk::Sampler> samplers{};
 			try {
 				auto descriptorSet = mDev.getLogicalDevice()->allocateDescriptorSets(allocInfo);
 
-				for(const auto& desc : description) {
-					if(desc.mDescriptor.mDescType == vk::DescriptorType::eCombinedImageSampler)
-						samplers.push_back(mDev.createSampler());
-				}
-
-				return {descriptorSet[0], description, samplers};
+				return {descriptorSet[0], description, &entry};
 			}
 			catch (...) {
 				std::cerr << "pool exhausted trying next descriptor pool \n";
-
-				for(auto& sampler : samplers) {
-					mDev.destroySampler(sampler);
-				}
 			}
 		}
 		vk::DescriptorPool newPool = allocateNewPool();
@@ -91,18 +135,14 @@ ThiefVKDescriptorSet ThiefVKDescriptorManager::createDescriptorSet(const ThiefVK
 
 
 vk::DescriptorSetLayout ThiefVKDescriptorManager::getDescriptorSetLayout(const ThiefVKDescriptorSetDescription& description) {
-	if (const auto layout = mFreeCache[description].first; layout != vk::DescriptorSetLayout{ nullptr }) return layout;
-
-	else {
-		vk::DescriptorSetLayout createdLayout = createDescriptorSetLayout(description);
-		mFreeCache[description].first = createdLayout;
-
-		return createdLayout;
-	}
+	return getCacheEntry(description).mLayout;
 }
 
 
 vk::DescriptorSetLayout ThiefVKDescriptorManager::createDescriptorSetLayout(const ThiefVKDescriptorSetDescription& description) {
+	// sets are written from a fixed size block, so a set with more couldn't be written.
+	if(description.size() > kMaxDescriptorsPerSet) throw std::runtime_error{"Descriptor set has more than " + std::to_string(kMaxDescriptorsPerSet) + " descriptors"};
+
 	std::vector<vk::DescriptorSetLayoutBinding> layoutBindings = extractLayoutBindings(description);
 
 	vk::DescriptorSetLayoutCreateInfo info{};
@@ -114,66 +154,131 @@ vk::DescriptorSetLayout ThiefVKDescriptorManager::createDescriptorSetLayout(cons
 
 
 void ThiefVKDescriptorManager::destroyDescriptorSet(const ThiefVKDescriptorSet& descSet) {
-	mFreeCache[descSet.mDesc].second.push_back(descSet);
+	descSet.mLayoutEntry->mFreeSets.emplace(descSet.mBoundResourcesHash, descSet);
 }
 
 
-void ThiefVKDescriptorManager::writeDescriptorSet(ThiefVKDescriptorSet& descSet) {
-	std::vector<vk::WriteDescriptorSet> descSetWrites{};
-	uint32_t samplerCount = 0;
+vk::DescriptorUpdateTemplate ThiefVKDescriptorManager::createUpdateTemplate(const ThiefVKDescriptorSetDescription& description, const vk::DescriptorSetLayout layout) {
+	if(!mUpdateTemplatesSupported) return vk::DescriptorUpdateTemplate(nullptr);
+
+	std::vector<vk::DescriptorUpdateTemplateEntry> entries{};
+	for(uint32_t i = 0; i < description.size(); ++i) {
+		vk::DescriptorUpdateTemplateEntry entry{};
+		entry.setDstBinding(description[i].mDescriptor.mBinding);
+		entry.setDstArrayElement(0);
+		entry.setDescriptorCount(1);
+		entry.setDescriptorType(description[i].mDescriptor.mDescType);
+		entry.setOffset(offsetof(ThiefVKDescriptorUpdateData, mEntries) + i * sizeof(ThiefVKDescriptorUpdateEntry));
+		entry.setStride(sizeof(ThiefVKDescriptorUpdateEntry));
+
+		entries.push_back(entry);
+	}
+
+	vk::DescriptorUpdateTemplateCreateInfo info{};
+	info.setDescriptorUpdateEntryCount(entries.size());
+	info.setPDescriptorUpdateEntries(entries.data());
+	info.setTemplateType(vk::DescriptorUpdateTemplateType::eDescriptorSet);
+	info.setDescriptorSetLayout(layout);
+
+	return mDev.getLogicalDevice()->createDescriptorUpdateTemplate(info);
+}
+
+
+void ThiefVKDescriptorManager::fillUpdateData(const ThiefVKDescriptorSetDescription& description, ThiefVKDescriptorUpdateData& data) {
+	if(mSampler == vk::Sampler(nullptr)) mSampler = mDev.getSampler();
+
+	for (uint32_t i = 0; i < description.size(); ++i) {
+		const auto& desc = description[i];
+		ThiefVKDescriptorUpdateEntry& entry = data.mEntries[i];
+
+		if(const auto imageView = std::get_if<vk::ImageView*>(&desc.mResource); imageView != nullptr) {
+			// input attachments don't have a sampler
+			entry.mImage.sampler = desc.mDescriptor.mDescType == vk::DescriptorType::eCombinedImageSampler ? static_cast<VkSampler>(mSampler) : VK_NULL_HANDLE;
+			entry.mImage.imageView = static_cast<VkImageView>(**imageView);
+			entry.mImage.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		} else {
+			const ThiefVKBuffer* buffer = std::get<ThiefVKBuffer*>(desc.mResource);
+			entry.mBuffer.buffer = static_cast<VkBuffer>(buffer->mBuffer);
+			entry.mBuffer.offset = buffer->mOffset;
+			entry.mBuffer.range  = buffer->mSize;
+		}
+	}
+}
+
 
-	// so we don't end up with more use after stack bugs here
-	// keep them alive until the ebd of the function.
-	std::vector<vk::DescriptorImageInfo> imageInfos;
-	std::vector<vk::DescriptorBufferInfo> bufferInfos;
-	imageInfos.reserve(descSet.mDesc.size());
-	bufferInfos.reserve(descSet.mDesc.size());
+void ThiefVKDescriptorManager::writeDescriptorSet(ThiefVKDescriptorSet& descSet, const LayoutCacheEntry& cacheEntry) {
+	ThiefVKDescriptorUpdateData data;
+	fillUpdateData(descSet.mDesc, data);
 
-	for (uint32_t i = 0; i< descSet.mDesc.size(); ++i) {
+	if(cacheEntry.mUpdateTemplate != vk::DescriptorUpdateTemplate(nullptr)) {
+		mDev.getLogicalDevice()->updateDescriptorSetWithTemplate(descSet.mDescSet, cacheEntry.mUpdateTemplate, &data);
+		return;
+	}
+
+	// without templates the writes point straight in to the packed data.
+	std::array<vk::WriteDescriptorSet, kMaxDescriptorsPerSet> descSetWrites{};
+	for (uint32_t i = 0; i < descSet.mDesc.size(); ++i) {
 		const auto& description = descSet.mDesc[i];
 
-		vk::WriteDescriptorSet descWrite{};
-		descWrite.setDstBinding(i);
+		vk::WriteDescriptorSet& descWrite = descSetWrites[i];
+		descWrite.setDstBinding(description.mDescriptor.mBinding);
 		descWrite.setDescriptorCount(1);
 		descWrite.setDescriptorType(description.mDescriptor.mDescType);
 		descWrite.setDstSet(descSet.mDescSet);
 
-		vk::DescriptorImageInfo imageInfo{};
+		if(description.mResource.index() == 0) {
+			descWrite.setPImageInfo(reinterpret_cast<const vk::DescriptorImageInfo*>(&data.mEntries[i].mImage));
+		} else {
+			descWrite.setPBufferInfo(reinterpret_cast<const vk::DescriptorBufferInfo*>(&data.mEntries[i].mBuffer));
+		}
+	}
 
-		vk::DescriptorBufferInfo bufferInfo{};
+	mDev.getLogicalDevice()->updateDescriptorSets(descSet.mDesc.size(), descSetWrites.data(), 0, nullptr);
+}
 
 
-		switch (description.mResource.index()) {
-			case 0:
-				imageInfo.setSampler(descSet.mSamplers[samplerCount]);
-				imageInfo.setImageView(*std::get<vk::ImageView*>(description.mResource));
-				imageInfo.setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+ThiefVKBoundResource ThiefVKDescriptorManager::getBoundResource(const ThiefVKDescriptorDescription& description) {
+	ThiefVKBoundResource boundResource{};
 
-				imageInfos.push_back(imageInfo);
-				descWrite.setPImageInfo(&imageInfos.back());
-				++samplerCount;
-				break;
-			case 1:
-				bufferInfo.setBuffer(*std::get<vk::Buffer*>(description.mResource));
-				bufferInfo.setOffset(0);
-				bufferInfo.setRange(VK_WHOLE_SIZE);
+	if(const auto imageView = std::get_if<vk::ImageView*>(&description.mResource); imageView != nullptr) {
+		boundResource.mImageView = **imageView;
+	} else {
+		const ThiefVKBuffer* buffer = std::get<ThiefVKBuffer*>(description.mResource);
+		boundResource.mBuffer = buffer->mBuffer;
+		boundResource.mOffset = buffer->mOffset;
+		boundResource.mSize   = buffer->mSize;
+	}
 
-				bufferInfos.push_back(bufferInfo);
-				descWrite.setPBufferInfo(&bufferInfos.back());
-				break;
-			default:
-				break;
-		}
+	return boundResource;
+}
+
+
+uint64_t ThiefVKDescriptorManager::hashBoundResources(const ThiefVKDescriptorSetDescription& description) {
+	uint64_t hash = 0;
+	for(const auto& desc : description) {
+		const ThiefVKBoundResource boundResource = getBoundResource(desc);
+		hash = ThiefVKHashBytes(&boundResource, sizeof(ThiefVKBoundResource), hash);
+	}
 
-		descSetWrites.push_back(descWrite);
+	return hash;
+}
+
+
+bool ThiefVKDescriptorManager::boundResourcesMatch(const ThiefVKDescriptorSet& descSet) {
+	for(uint32_t i = 0; i < descSet.mDesc.size(); ++i) {
+		if(!(descSet.mBoundResources[i] == getBoundResource(descSet.mDesc[i]))) return false;
 	}
 
-	mDev.getLogicalDevice()->updateDescriptorSets(descSetWrites, {});
+	return true;
 }
 
 
 vk::DescriptorPool ThiefVKDescriptorManager::allocateNewPool() {
-	return mDev.createDescriptorPool();
+	// each pool is twice the size of the last, so the number of pools grows with the log of the draw count.
+	const vk::DescriptorPool pool = mDev.createDescriptorPool(mNextPoolSize);
+	mNextPoolSize *= 2;
+
+	return pool;
 }
 
 
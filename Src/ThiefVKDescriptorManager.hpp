@@ -3,45 +3,106 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include <array>
 #include <vector>
-#include <map>
+#include <unordered_map>
 #include <variant>
 
+#include "ThiefVKMemoryManager.hpp"
+
+// Bind every texture once in a single partially bound array indexed with a push constant,
+// instead of writing a descriptor set per draw. Needs VK_EXT_descriptor_indexing, devices
+// without it or the features it needs fall back to a set per draw at runtime.
+#define BINDLESS_TEXTURES 0
+
+constexpr uint32_t kMaxBindlessTextures = 4096; // has to match the array size in ColourBindless.frag
+constexpr uint32_t kInvalidBindlessSlot = ~0u; // textures that aren't in the table, draws with them use a set per draw
+constexpr uint32_t kMaxDescriptorsPerSet = 8; // layouts with more are rejected when they're created
+
 class ThiefVKDevice;
 class ThiefVKDescriptorManager;
+struct ThiefVKDescriptorLayoutCacheEntry;
 
 struct ThiefVKDescriptor {
 	vk::DescriptorType mDescType;
 	vk::ShaderStageFlagBits mShaderStage;
 	uint32_t mBinding;
 };
+bool operator==(const ThiefVKDescriptor&, const ThiefVKDescriptor&);
 
 struct ThiefVKDescriptorDescription {
 	ThiefVKDescriptor mDescriptor;
-	std::variant<vk::ImageView*, vk::Buffer*> mResource;
+	std::variant<vk::ImageView*, ThiefVKBuffer*> mResource;
 };
-bool operator<(const ThiefVKDescriptorDescription&, const ThiefVKDescriptorDescription&);
 
 
 using ThiefVKDescriptorSetDescription = std::vector<ThiefVKDescriptorDescription>;
 
+// Only the descriptors affect the layout, so sets with different resources share a hash.
+uint64_t hashDescriptorSetLayout(const ThiefVKDescriptorSetDescription&);
+
+// Key for the layout cache, the hash is worked out once when the key is filled in.
+struct ThiefVKDescriptorSetLayoutKey {
+	std::vector<ThiefVKDescriptor> mDescriptors;
+	uint64_t mHash = 0;
+};
+bool operator==(const ThiefVKDescriptorSetLayoutKey&, const ThiefVKDescriptorSetLayoutKey&);
+
+struct ThiefVKDescriptorSetLayoutKeyHasher {
+	size_t operator()(const ThiefVKDescriptorSetLayoutKey& key) const { return static_cast<size_t>(key.mHash); }
+};
+
+
+// The handles a descriptor was last written with, the description only holds pointers to them.
+struct ThiefVKBoundResource {
+	vk::ImageView mImageView;
+	vk::Buffer mBuffer;
+	uint64_t mOffset;
+	uint64_t mSize;
+};
+bool operator==(const ThiefVKBoundResource&, const ThiefVKBoundResource&);
+
+
+// A whole sets worth of descriptor writes packed in to one block, one entry per
+// descriptor in description order. This is what the sets update template reads from.
+union ThiefVKDescriptorUpdateEntry {
+	VkDescriptorImageInfo mImage;
+	VkDescriptorBufferInfo mBuffer;
+};
+
+struct ThiefVKDescriptorUpdateData {
+	ThiefVKDescriptorUpdateEntry mEntries[kMaxDescriptorsPerSet];
+};
+
 
 class ThiefVKDescriptorSet {
 public:
 	friend ThiefVKDescriptorManager;
 
 	ThiefVKDescriptorSet() = default;
-	ThiefVKDescriptorSet(const vk::DescriptorSet& descSet, const ThiefVKDescriptorSetDescription& desc, std::vector<vk::Sampler>& samplers) : 
+	ThiefVKDescriptorSet(const vk::DescriptorSet& descSet, const ThiefVKDescriptorSetDescription& desc, ThiefVKDescriptorLayoutCacheEntry* layoutEntry) : 
 		mDescSet{ descSet }, 
 		mDesc{ desc }, 
-		mSamplers{ samplers } {}
+		mLayoutEntry{ layoutEntry } {}
 
 	vk::DescriptorSet& getHandle() { return mDescSet; }
 
 private:
 	vk::DescriptorSet mDescSet;
 	ThiefVKDescriptorSetDescription mDesc;
-	std::vector<vk::Sampler> mSamplers;
+	ThiefVKDescriptorLayoutCacheEntry* mLayoutEntry = nullptr; // in the managers cache, so it can be returned without a lookup
+
+	// what the set currently points at, so a recycled set can be handed out again without rewriting it.
+	std::array<ThiefVKBoundResource, kMaxDescriptorsPerSet> mBoundResources{};
+	uint64_t mBoundResourcesHash = 0;
+	uint64_t mWriteGeneration = 0;
+};
+
+
+struct ThiefVKDescriptorLayoutCacheEntry {
+	vk::DescriptorSetLayout mLayout;
+	vk::DescriptorUpdateTemplate mUpdateTemplate; // null if the device doesn't support them
+	std::unordered_multimap<uint64_t, ThiefVKDescriptorSet> mFreeSets; // keyed by the hash of the resources they were last written with
 };
 
 
@@ -54,19 +115,40 @@ public:
 	vk::DescriptorSetLayout getDescriptorSetLayout(const ThiefVKDescriptorSetDescription&);
 
 	void destroyDescriptorSet(const ThiefVKDescriptorSet&);
+
+	// Has to be called when a resource that could be in a cached set is destroyed, as
+	// a new one could be created with the same handle.
+	void invalidateCachedWrites() { ++mWriteGeneration; }
 private:
+	using LayoutCacheEntry = ThiefVKDescriptorLayoutCacheEntry;
 
-	ThiefVKDescriptorSet createDescriptorSet(const ThiefVKDescriptorSetDescription&);
+	// Finds or creates the entry for description, one hash and one lookup.
+	LayoutCacheEntry& getCacheEntry(const ThiefVKDescriptorSetDescription&);
+
+	ThiefVKDescriptorSet createDescriptorSet(const ThiefVKDescriptorSetDescription&, LayoutCacheEntry&);
 	vk::DescriptorSetLayout createDescriptorSetLayout(const ThiefVKDescriptorSetDescription&);
-	void writeDescriptorSet(ThiefVKDescriptorSet&);
+	vk::DescriptorUpdateTemplate createUpdateTemplate(const ThiefVKDescriptorSetDescription&, const vk::DescriptorSetLayout);
+	void writeDescriptorSet(ThiefVKDescriptorSet&, const LayoutCacheEntry&);
+	void fillUpdateData(const ThiefVKDescriptorSetDescription&, ThiefVKDescriptorUpdateData&);
+	static ThiefVKBoundResource getBoundResource(const ThiefVKDescriptorDescription&);
+	static uint64_t hashBoundResources(const ThiefVKDescriptorSetDescription&);
+	static bool boundResourcesMatch(const ThiefVKDescriptorSet&); // against the sets description
 	vk::DescriptorPool allocateNewPool();
 	std::vector<vk::DescriptorSetLayoutBinding> extractLayoutBindings(const ThiefVKDescriptorSetDescription&) const ;
 
 	ThiefVKDevice& mDev;
 
-	std::vector<vk::DescriptorPool> mPools;
+	std::vector<vk::DescriptorPool> mPools; // newest, and so largest, first
+	uint32_t mNextPoolSize = 64; // in sets
+
+	bool mUpdateTemplatesSupported;
+	vk::Sampler mSampler; // every combined image sampler uses the same sampler state
+
+	// entries are never erased, so sets can hold on to pointers to them.
+	std::unordered_map<ThiefVKDescriptorSetLayoutKey, LayoutCacheEntry, ThiefVKDescriptorSetLayoutKeyHasher> mLayoutCache;
+	ThiefVKDescriptorSetLayoutKey mLookupKey; // reused for every lookup so finding an entry doesn't allocate
 
-	std::map<ThiefVKDescriptorSetDescription, std::pair<vk::DescriptorSetLayout, std::vector<ThiefVKDescriptorSet>>> mFreeCache;
+	uint64_t mWriteGeneration = 1; // sets written before the last invalidateCachedWrites can't be reused as is
 };
 
 
@@ -2,16 +2,29 @@
 #include "ThiefVKInstance.hpp"
 #include "ThiefVKDescriptorManager.hpp"
 #include "ThiefVKModel.hpp"
+#include "ThiefVKHash.hpp"
 
 #include "stb_image.h"
 
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
 #include <array>
+#include <cstring>
 #include <set>
 #include <iostream>
 #include <limits>
 
 #define DEBUG_SHOW_NORMALS 0
 
+constexpr uint64_t kStagingRingSizePerFrame = 32 * 1000000;
+constexpr uint64_t kUniformRingSizePerFrame = 4 * 1000000;
+constexpr uint64_t kDefragmentationBytesPerFrame = 8 * 1000000;
+constexpr uint64_t kSharedBufferBlockSize = 64 * 1000000; // buffers bigger than half this get there own vk::Buffer
+
+constexpr const char* kColourShader         = "Colour.frag.spv";
+constexpr const char* kBindlessColourShader = "ColourBindless.frag.spv";
+
 // ThiefVKDeviceMemberFunctions
 
 ThiefVKDevice::ThiefVKDevice(std::pair<vk::PhysicalDevice, vk::Device> Devices, vk::SurfaceKHR surface, GLFWwindow * window) :
@@ -19,12 +32,13 @@ ThiefVKDevice::ThiefVKDevice(std::pair<vk::PhysicalDevice, vk::Device> Devices,
 	mDevice{std::get<1>(Devices)},
     mLimits{mPhysDev.getProperties().limits}, 
     finishedSubmissionID{0},
+    currentSubmissionID{0},
     currentFrameBufferIndex{0},
 	pipelineManager{*this},
 	MemoryManager{&mPhysDev, &mDevice},
-	mUniformBufferManager{*this, vk::BufferUsageFlagBits::eUniformBuffer, mLimits.minUniformBufferOffsetAlignment},
-	mVertexBufferManager{*this, vk::BufferUsageFlagBits::eVertexBuffer},
-    mIndexBufferManager{*this, vk::BufferUsageFlagBits::eIndexBuffer},
+    mStagingRing{*this, vk::BufferUsageFlagBits::eTransferSrc, kStagingRingSizePerFrame},
+    mUniformRing{*this, vk::BufferUsageFlagBits::eUniformBuffer, kUniformRingSizePerFrame, ThiefVKMemoryUsage::DeviceLocalHostVisible},
+    mTransferQueue{*this},
     mSpotLightBufferManager{*this, vk::BufferUsageFlagBits::eUniformBuffer},
 	DescriptorManager{*this},
 	mWindowSurface{surface}, 
@@ -36,31 +50,70 @@ ThiefVKDevice::ThiefVKDevice(std::pair<vk::PhysicalDevice, vk::Device> Devices,
     mGraphicsQueue = mDevice.getQueue(queueIndices.GraphicsQueueIndex, 0);
     mPresentQueue  = mDevice.getQueue(queueIndices.PresentQueueIndex, 0);
     mComputeQueue  = mDevice.getQueue(queueIndices.ComputeQueueIndex, 0);
+
+    // needs to be created before any buffers so they get the right sharing mode.
+    mTransferQueue.create(queueIndices);
+
+#if BINDLESS_TEXTURES
+    mBindlessEnabled = createBindlessTextureTable();
+#endif
 }
 
 
 ThiefVKDevice::~ThiefVKDevice() {
     mDevice.waitIdle();
 
-    // unique buffers, this is needed as multiple frameResources structs can have handles to the same 
-    // device buffers. This avoids double freeing any of them.
-    std::set<ThiefVKBuffer> uniqueBuffers;
+    mTransferQueue.destroy();
+
     for(auto& resource : frameResources) {
         destroyPerFrameResources(resource);
-        uniqueBuffers.insert(resource.vertexBuffer);
-        uniqueBuffers.insert(resource.indexBuffer);
-        uniqueBuffers.insert(resource.uniformBuffer);
-        uniqueBuffers.insert(resource.spotLightBuffer);
     }
 
-    for(auto buffer : uniqueBuffers) {
-        DestroyBufferInternal(buffer);
+    // the frameResources buffers are just handles to the buffers the managers own.
+    mSpotLightBufferManager.destroy();
+
+    for(auto& [hash, sharedGeometry] : mSharedGeometry) {
+        destroyBuffer(sharedGeometry.vertexBuffer);
+        destroyBuffer(sharedGeometry.indexBuffer);
+    }
+
+    for(auto& [uploadValue, buffer] : mPendingTransferFreeBuffers) {
+        destroyBuffer(buffer);
     }
 
     for(auto& [path, texture] : mTextureCache) {
         destroyImage(texture);
     }
 
+    for(auto& [path, view] : mTextureViews) {
+        mDevice.destroyImageView(view);
+    }
+
+    for(auto& [submissionID, view] : mPendingFreeImageViews) {
+        mDevice.destroyImageView(view);
+    }
+
+#if BINDLESS_TEXTURES
+    if(mBindlessEnabled) destroyBindlessTextureTable();
+#endif
+
+    for(auto& [submissionID, image] : mPendingFreeImages) {
+        destroyImage(image);
+    }
+
+    mStagingRing.destroy();
+    mUniformRing.destroy();
+
+    // release the slices before the shared buffers they came from.
+    for(auto& [submissionID, buffer] : mPendingFreeBuffers) {
+        DestroyBufferInternal(buffer);
+    }
+    mPendingFreeBuffers.clear();
+
+    for(auto& [usageClass, sharedBuffers] : mSharedBuffers) {
+        sharedBuffers.destroy();
+    }
+
     for(auto& [submissionID, buffer] : mPendingFreeBuffers) {
         DestroyBufferInternal(buffer);
     }
@@ -70,6 +123,10 @@ ThiefVKDevice::~ThiefVKDevice() {
     pipelineManager.Destroy();
     MemoryManager.Destroy();
 	DescriptorManager.Destroy();
+
+    for(auto& [info, sampler] : mSamplerCache) {
+        mDevice.destroySampler(sampler);
+    }
     mSwapChain.destroy(mDevice);
     mDevice.destroyRenderPass(mRenderPasses.RenderPass);
     mDevice.destroyCommandPool(graphicsCommandPool);
@@ -88,10 +145,20 @@ void ThiefVKDevice::startFrame() {
     
     currentSubmissionID++;
     DestroyPendingBuffers();
+    DestroyPendingImages();
+#if BINDLESS_TEXTURES
+    DestroyPendingBindlessTextures();
+#endif
+    mTransferQueue.collectFinished();
+    DestroyPendingTransferBuffers();
 
     mDevice.waitForFences(frameResources[currentFrameBufferIndex].frameFinished, true, std::numeric_limits<uint64_t>::max());
     mDevice.resetFences(1, &frameResources[currentFrameBufferIndex].frameFinished);
 
+    // The GPU is done with this frames staging memory so it can be reused.
+    mStagingRing.beginFrame(currentFrameBufferIndex);
+    mUniformRing.beginFrame(currentFrameBufferIndex);
+
     if(frameResources[currentFrameBufferIndex].primaryCmdBuffer == vk::CommandBuffer(nullptr)) {
         // Only allocate the command buffers if this will be there first use.
         vk::CommandBufferAllocateInfo primaryCmdBufferAllocInfo;
@@ -137,63 +204,48 @@ void ThiefVKDevice::startFrame() {
         }
         resources.stagingBuffers.clear();
 
-        for(auto& imageView : resources.textureImageViews) {
-            mDevice.destroyImageView(imageView);
-        }   
-        resources.textureImageViews.clear();
+        resources.textureImageViews.clear(); // these are owned by mTextureViews
 
         resources.textureImages.clear();
     }
 
     vk::CommandBufferBeginInfo beginInfo{};
     frameResources[currentFrameBufferIndex].flushCommandBuffer.begin(beginInfo);
+
+    defragmentDeviceMemory(kDefragmentationBytesPerFrame);
+    MemoryManager.TrimPools();
 }
 
 
 void ThiefVKDevice::endFrame() {
     auto& resources = frameResources[currentFrameBufferIndex];
 
-    // we defered the buffer destruction to here to we can avoid reuploading the buffer each 
-    // frame if it hasn't changed.
-    if(mVertexBufferManager.bufferHasChanged()) {
-        destroyBuffer(resources.vertexBuffer);
-        destroyBuffer(resources.indexBuffer);
-    }
-    if(mUniformBufferManager.bufferHasChanged()) {
-        destroyBuffer(resources.uniformBuffer);
-    }
-    if(mSpotLightBufferManager.bufferHasChanged()) {
-        destroyBuffer(resources.spotLightBuffer);
-    }
-
-    const std::vector<entryInfo> vertexBufferOffsets = mVertexBufferManager.getBufferOffsets();
-    auto [vertexBuffer, vertexStagingBuffer] = mVertexBufferManager.flushBufferUploads();
+    uploadPendingMeshes();
+    mTransferQueue.submit();
 
-    const std::vector<entryInfo> indexBufferOffsets = mIndexBufferManager.getBufferOffsets();
-    auto [indexBuffer, indexStagingBuffer]          = mIndexBufferManager.flushBufferUploads();
+    // Every draw reads it's constants through the same descriptor, the dynamic offset picks them out.
+    resources.uniformBuffer = ThiefVKBuffer{mUniformRing.getBuffer(), Allocation{}};
+    resources.uniformBuffer.mSize = sizeof(glm::mat4) * 3;
 
-    const std::vector<entryInfo> uniformBufferOffsets = mUniformBufferManager.getBufferOffsets();
-    auto [uniformBuffer, uniformStagingBuffer] = mUniformBufferManager.flushBufferUploads();
+    // The managers keep their device buffers between frames and only upload what has changed.
 
     const std::vector<entryInfo> spotLIghtOffsets = mSpotLightBufferManager.getBufferOffsets();
-    auto [spotLightBuffer, spotLightStagingBuffer] = mSpotLightBufferManager.flushBufferUploads();
-
-    resources.stagingBuffers.push_back(vertexStagingBuffer);
-    resources.vertexBuffer = vertexBuffer;
-    resources.stagingBuffers.push_back(uniformStagingBuffer);
-    resources.uniformBuffer = uniformBuffer;
-    resources.stagingBuffers.push_back(spotLightStagingBuffer);
-    resources.spotLightBuffer = spotLightBuffer;
-    resources.stagingBuffers.push_back(indexStagingBuffer);
-    resources.indexBuffer = indexBuffer;
+    resources.spotLightBuffer = mSpotLightBufferManager.flushBufferUploads();
 
     // Get all of the descriptor sets needed for this frame.
 
-	//Colour potentially needs one desc set per draw call as could bind a different texture per model
 	std::vector<ThiefVKDescriptorSet> colourDescriptorSets{};
-	colourDescriptorSets.reserve(vertexBufferOffsets.size()); // only allocate once.
-	for(uint32_t i = 0; i < vertexBufferOffsets.size(); ++i) {
-		const ThiefVKDescriptorSetDescription basicColourDesc = getDescriptorSetDescription("Colour.frag.spv", i);
+	colourDescriptorSets.reserve(mDrawCalls.size() + 1); // only allocate once.
+
+    // draws with textures in the bindless table all share the first set.
+    const uint32_t firstPerDrawColourSet = mBindlessEnabled ? 1 : 0;
+    if(mBindlessEnabled) colourDescriptorSets.push_back(DescriptorManager.getDescriptorSet(getDescriptorSetDescription(kBindlessColourShader)));
+
+	//The rest potentially need one desc set per draw call as could bind a different texture per model
+	for(const ThiefVKDrawCall& drawCall : mDrawCalls) {
+        if(drawCall.textureSlot != kInvalidBindlessSlot) continue;
+
+		const ThiefVKDescriptorSetDescription basicColourDesc = getDescriptorSetDescription(kColourShader, static_cast<uint32_t>(colourDescriptorSets.size()) - firstPerDrawColourSet);
 		colourDescriptorSets.push_back(DescriptorManager.getDescriptorSet(basicColourDesc));
 	}
 
@@ -216,30 +268,64 @@ void ThiefVKDevice::endFrame() {
 	
     startFrameInternal();
 
-	for (uint32_t i = 0; i < vertexBufferOffsets.size(); ++i) {
-		const vk::DeviceSize bufferOffset   = vertexBufferOffsets[i].offset;
-        const vk::DeviceSize indexOffset    = indexBufferOffsets[i].offset;
-        const vk::DeviceSize uniformOffset  = uniformBufferOffsets[i].offset;
+    uint64_t transferWaitValue = 0;
+
+    // switched per draw when some textures didn't fit in the bindless table.
+    const char* boundColourShader = mBindlessEnabled ? kBindlessColourShader : kColourShader;
+    uint32_t nextColourSet = firstPerDrawColourSet;
+
+	for (uint32_t i = 0; i < mDrawCalls.size(); ++i) {
+        ThiefVKMesh& mesh = mMeshes[mDrawCalls[i].mesh];
+        transferWaitValue = std::max(transferWaitValue, mesh.uploadValue);
+
+        // when the vertex streams are split they all come from the same buffer.
+        std::array<vk::DeviceSize, kVertexBindingCount> vertexOffsets = Vertex::getBindingOffsets(mesh.vertexCount);
+        std::array<vk::Buffer, kVertexBindingCount> vertexBuffers;
+        for(uint32_t binding = 0; binding < kVertexBindingCount; ++binding) {
+            vertexOffsets[binding] += mesh.vertexBuffer.mOffset;
+            vertexBuffers[binding] = mesh.vertexBuffer.mBuffer;
+        }
+
+        const vk::DeviceSize indexOffset    = mesh.indexBuffer.mOffset;
+        const uint32_t uniformOffset        = mDrawCalls[i].uniformOffset;
 		
-		resources.colourCmdBuffer.bindVertexBuffers(0, 1, &resources.vertexBuffer.mBuffer, &bufferOffset);
-        resources.colourCmdBuffer.bindIndexBuffer(resources.indexBuffer.mBuffer, indexOffset, vk::IndexType::eUint32);
-		resources.colourCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineManager.getPipelineLayout("Colour.frag.spv"), 0, colourDescriptorSets[i].getHandle(), uniformOffset);
-		resources.colourCmdBuffer.drawIndexed(indexBufferOffsets[i].numberOfEntries, 1, 0, 0, 0);
+		resources.colourCmdBuffer.bindVertexBuffers(0, kVertexBindingCount, vertexBuffers.data(), vertexOffsets.data());
+        resources.colourCmdBuffer.bindIndexBuffer(mesh.indexBuffer.mBuffer, indexOffset, mesh.indexType);
+
+        const bool bindless = mDrawCalls[i].textureSlot != kInvalidBindlessSlot;
+        const char* colourShader = bindless ? kBindlessColourShader : kColourShader;
+        if(colourShader != boundColourShader) {
+            resources.colourCmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelineManager.getPipeLine(getColourPipelineDescription(colourShader)));
+            boundColourShader = colourShader;
+        }
+#if BINDLESS_TEXTURES
+        if(bindless) {
+            const vk::PipelineLayout colourLayout = pipelineManager.getPipelineLayout(kBindlessColourShader);
+            const std::array<vk::DescriptorSet, 2> colourSets{colourDescriptorSets[0].getHandle(), mBindlessSet};
+            resources.colourCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, colourLayout, 0, colourSets, uniformOffset);
+            resources.colourCmdBuffer.pushConstants(colourLayout, vk::ShaderStageFlagBits::eFragment, 0, sizeof(uint32_t), &mDrawCalls[i].textureSlot);
+        } else
+#endif
+        {
+            resources.colourCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineManager.getPipelineLayout(kColourShader), 0, colourDescriptorSets[nextColourSet++].getHandle(), uniformOffset);
+        }
+		resources.colourCmdBuffer.drawIndexed(mesh.indexCount, 1, 0, 0, 0);
 
-		resources.normalsCmdBuffer.bindVertexBuffers(0, 1, &resources.vertexBuffer.mBuffer, &bufferOffset);
-        resources.normalsCmdBuffer.bindIndexBuffer(resources.indexBuffer.mBuffer, indexOffset, vk::IndexType::eUint32);
+		resources.normalsCmdBuffer.bindVertexBuffers(0, kVertexBindingCount, vertexBuffers.data(), vertexOffsets.data());
+        resources.normalsCmdBuffer.bindIndexBuffer(mesh.indexBuffer.mBuffer, indexOffset, mesh.indexType);
 #if DEBUG_SHOW_NORMALS
         resources.normalsCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineManager.getPipelineLayout("NormalDebug.frag.spv"), 0, normalsDescriptor.getHandle(), uniformOffset);
 #else
         resources.normalsCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineManager.getPipelineLayout("Normal.frag.spv"), 0, normalsDescriptor.getHandle(), uniformOffset);
 #endif
-        resources.normalsCmdBuffer.drawIndexed(indexBufferOffsets[i].numberOfEntries, 1, 0, 0, 0);
+        resources.normalsCmdBuffer.drawIndexed(mesh.indexCount, 1, 0, 0, 0);
 
-        resources.albedoCmdBuffer.bindVertexBuffers(0, 1, &resources.vertexBuffer.mBuffer, &bufferOffset);
-        resources.albedoCmdBuffer.bindIndexBuffer(resources.indexBuffer.mBuffer, indexOffset, vk::IndexType::eUint32);
+        resources.albedoCmdBuffer.bindVertexBuffers(0, kVertexBindingCount, vertexBuffers.data(), vertexOffsets.data());
+        resources.albedoCmdBuffer.bindIndexBuffer(mesh.indexBuffer.mBuffer, indexOffset, mesh.indexType);
         resources.albedoCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineManager.getPipelineLayout("Albedo.frag.spv"), 0, albedoDescriptor.getHandle(), uniformOffset );
-        resources.albedoCmdBuffer.drawIndexed(indexBufferOffsets[i].numberOfEntries, 1, 0, 0, 0);
+        resources.albedoCmdBuffer.drawIndexed(mesh.indexCount, 1, 0, 0, 0);
 	}
+    mDrawCalls.clear();
 
     glm::vec4 pushConstants[5];
     pushConstants[0] = glm::vec4(spotLIghtOffsets[0].numberOfEntries);
@@ -252,7 +338,7 @@ void ThiefVKDevice::endFrame() {
     resources.compositeCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineManager.getPipelineLayout("Composite.frag.spv"), 0, compositeDescriptor.getHandle(), {} );
     resources.compositeCmdBuffer.draw(3,1,0,0);
 
-    endFrameInternal();
+    endFrameInternal(transferWaitValue);
 }
 
 
@@ -287,23 +373,178 @@ void ThiefVKDevice::startFrameInternal() {
 }
 
 
+// Meshes with identical vertices and indicies share one copy on the GPU, only the
+// first one to be registered is uploaded. Geometry is found by a 64 bit hash of all of
+// its data, and only shared when the counts, index type and a second hash with a
+// different seed match too. Anything else gets its own geometry under the same hash.
+ThiefVKMeshHandle ThiefVKDevice::registerMesh(const geometry& geom) {
+    const uint64_t vertexCount = geom.verticies.size();
+    const uint64_t indexCount  = geom.getIndexCount();
+    const vk::IndexType indexType = geom.getIndexType();
+
+    // the counts and index type go in first so streams that only differ in where one ends don't match.
+    const auto hashGeometry = [&](const uint64_t seed) {
+        uint64_t hash = ThiefVKHashBytes(&vertexCount, sizeof(uint64_t), seed);
+        hash = ThiefVKHashBytes(&indexCount, sizeof(uint64_t), hash);
+        hash = ThiefVKHashBytes(&indexType, sizeof(vk::IndexType), hash);
+        hash = ThiefVKHashBytes(geom.verticies.data(), geom.verticies.size() * sizeof(MeshVertex), hash);
+        hash = ThiefVKHashBytes(geom.getIndexData(), geom.getIndexDataSize(), hash);
+        return ThiefVKHashBytes(&geom.positionOffsetAndScale, sizeof(glm::vec4), hash);
+    };
+    const uint64_t hash      = hashGeometry(0);
+    const uint64_t checkHash = hashGeometry(0x9E3779B97F4A7C15ull);
+
+    auto sharedGeometry = mSharedGeometry.end();
+    for(auto [candidate, candidatesEnd] = mSharedGeometry.equal_range(hash); candidate != candidatesEnd; ++candidate) {
+        const ThiefVKMeshGeometry& existing = candidate->second;
+        if(existing.vertexCount == vertexCount && existing.indexCount == indexCount && existing.indexType == indexType && existing.checkHash == checkHash) {
+            sharedGeometry = candidate;
+            break;
+        }
+    }
+
+    if(sharedGeometry == mSharedGeometry.end()) {
+        ThiefVKMeshGeometry newGeometry{};
+        newGeometry.vertexBuffer = createBuffer(vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst, Vertex::getVertexDataSize(geom.verticies.size()));
+        newGeometry.indexBuffer  = createBuffer(vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst, geom.getIndexDataSize());
+        newGeometry.vertexCount  = geom.verticies.size();
+        newGeometry.indexCount   = geom.getIndexCount();
+        newGeometry.indexType    = geom.getIndexType();
+        newGeometry.checkHash    = checkHash;
+        newGeometry.references   = 0;
+        newGeometry.uploadValue  = 0;
+
+        const uint64_t vertexSize = Vertex::getVertexDataSize(newGeometry.vertexCount);
+        const uint64_t indexSize  = geom.getIndexDataSize();
+
+        // both streams go through the transfer queue or neither do.
+        char* staging = nullptr;
+        if(mTransferQueue.isEnabled() && newGeometry.vertexBuffer.mSize != 0 && newGeometry.indexBuffer.mSize != 0) {
+            staging = static_cast<char*>(mTransferQueue.upload({{newGeometry.vertexBuffer, vertexSize}, {newGeometry.indexBuffer, indexSize}}));
+        }
+
+        if(staging != nullptr) {
+            Vertex::writeVertexData(geom.verticies, staging);
+            std::memcpy(staging + vertexSize, geom.getIndexData(), indexSize);
+            newGeometry.uploadValue = mTransferQueue.getRecordingValue();
+        }
+
+        sharedGeometry = mSharedGeometry.emplace(hash, newGeometry);
+
+        // we might not be recording a frame yet, so hold on to the data until endFrame.
+        if(staging == nullptr) mPendingMeshUploads.push_back({&sharedGeometry->second, geom});
+    }
+    ++sharedGeometry->second.references;
+
+    ThiefVKMesh mesh{};
+    mesh.vertexBuffer = sharedGeometry->second.vertexBuffer;
+    mesh.indexBuffer  = sharedGeometry->second.indexBuffer;
+    mesh.vertexCount  = sharedGeometry->second.vertexCount;
+    mesh.indexCount   = sharedGeometry->second.indexCount;
+    mesh.indexType    = sharedGeometry->second.indexType;
+    mesh.geometryHash = hash;
+    mesh.geometry     = &sharedGeometry->second;
+    mesh.uploadValue  = sharedGeometry->second.uploadValue;
+    mesh.positionOffsetAndScale = geom.positionOffsetAndScale;
+    mesh.texturePath  = geom.texturePath;
+
+    ThiefVKMeshHandle handle;
+    if(!mFreeMeshHandles.empty()) {
+        handle = mFreeMeshHandles.back();
+        mFreeMeshHandles.pop_back();
+        mMeshes[handle] = mesh;
+    } else {
+        handle = static_cast<ThiefVKMeshHandle>(mMeshes.size());
+        mMeshes.push_back(mesh);
+    }
+
+    return handle;
+}
+
+
+void ThiefVKDevice::unregisterMesh(const ThiefVKMeshHandle handle) {
+    ThiefVKMesh& mesh = mMeshes[handle];
+    const uint64_t hash = mesh.geometryHash;
+    ThiefVKMeshGeometry* const geometry = mesh.geometry;
+    mesh = ThiefVKMesh{};
+    mFreeMeshHandles.push_back(handle);
+
+    ThiefVKMeshGeometry& sharedGeometry = *geometry;
+    if(--sharedGeometry.references != 0) return;
+
+    // the buffers can't be released while the transfer queue could still be writing to them.
+    if(sharedGeometry.uploadValue > mTransferQueue.getCompletedValue()) {
+        mPendingTransferFreeBuffers.push_back({sharedGeometry.uploadValue, sharedGeometry.vertexBuffer});
+        mPendingTransferFreeBuffers.push_back({sharedGeometry.uploadValue, sharedGeometry.indexBuffer});
+    } else {
+        destroyBuffer(sharedGeometry.vertexBuffer);
+        destroyBuffer(sharedGeometry.indexBuffer);
+    }
+
+    // it might not have made it to the GPU yet.
+    mPendingMeshUploads.erase(std::remove_if(mPendingMeshUploads.begin(), mPendingMeshUploads.end(), [geometry](const auto& upload) { return upload.first == geometry; }), mPendingMeshUploads.end());
+
+    auto candidate = mSharedGeometry.equal_range(hash).first;
+    while(&candidate->second != geometry) ++candidate;
+    mSharedGeometry.erase(candidate);
+}
+
+
+void ThiefVKDevice::uploadPendingMeshes() {
+    for(const auto& [sharedGeometry, geom] : mPendingMeshUploads) {
+        ThiefVKMeshGeometry& mesh = *sharedGeometry;
+
+        const uint64_t vertexSize = Vertex::getVertexDataSize(geom.verticies.size());
+        const uint64_t indexSize  = geom.getIndexDataSize();
+        if(vertexSize == 0 || indexSize == 0) continue;
+
+        ThiefVKRingAllocation stagingMemory = getStagingMemory(vertexSize + indexSize);
+        char* memory = static_cast<char*>(stagingMemory.mMappedPointer);
+        Vertex::writeVertexData(geom.verticies, memory);
+        std::memcpy(memory + vertexSize, geom.getIndexData(), indexSize);
+
+        copyBufferRegions(stagingMemory.mBuffer, mesh.vertexBuffer.mBuffer, {vk::BufferCopy{stagingMemory.mOffset, mesh.vertexBuffer.mOffset, vertexSize}}, vk::BufferUsageFlagBits::eVertexBuffer);
+        copyBufferRegions(stagingMemory.mBuffer, mesh.indexBuffer.mBuffer, {vk::BufferCopy{stagingMemory.mOffset + vertexSize, mesh.indexBuffer.mOffset, indexSize}}, vk::BufferUsageFlagBits::eIndexBuffer);
+    }
+    mPendingMeshUploads.clear();
+}
+
+
 // Just gather all the state we need here, then call Start RenderScene.
-void ThiefVKDevice::draw(const geometry& geom) {
-    mVertexBufferManager.addBufferElements(geom.verticies);
-    mUniformBufferManager.addBufferElements({geom.object, geom.camera, geom.world});
-    mIndexBufferManager.addBufferElements(geom.indicies);
+void ThiefVKDevice::draw(const ThiefVKMeshHandle handle, const glm::mat4& object, const glm::mat4& camera, const glm::mat4& world) {
+    if(mMeshes[handle].indexCount == 0) return;
 
-    auto image = createTexture(geom.texturePath); 
-    frameResources[currentFrameBufferIndex].textureImages.push_back(image);
+    ThiefVKRingAllocation constants = mUniformRing.allocate(sizeof(glm::mat4) * 3, mLimits.minUniformBufferOffsetAlignment);
+    if(constants.mBuffer == vk::Buffer(nullptr)) {
+        std::cerr << "Out of uniform ring memory, dropping draw \n";
+        return;
+    }
 
-    // create an image View as well.
-    vk::ImageViewCreateInfo viewInfo{};
-    viewInfo.setImage(image.mImage);
-    viewInfo.setFormat(vk::Format::eR8G8B8A8Unorm);
-    viewInfo.setViewType(vk::ImageViewType::e2D);
-    viewInfo.setSubresourceRange({vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+    glm::mat4* matricies = static_cast<glm::mat4*>(constants.mMappedPointer);
+#if COMPACT_VERTICES
+    // compact positions are relative to the meshes bounds.
+    const glm::vec4& bounds = mMeshes[handle].positionOffsetAndScale;
+    matricies[0] = glm::scale(glm::translate(object, glm::vec3(bounds)), glm::vec3(bounds.w));
+#else
+    matricies[0] = object;
+#endif
+    matricies[1] = camera;
+    matricies[2] = world;
+
+    auto image = createTexture(mMeshes[handle].texturePath); // loads it in to the bindless table if it isn't already
+
+    uint32_t textureSlot = kInvalidBindlessSlot;
+#if BINDLESS_TEXTURES
+    const auto bindlessSlot = mBindlessTextureSlots.find(mMeshes[handle].texturePath); // missing if the texture failed to load
+    if(mBindlessEnabled && bindlessSlot != mBindlessTextureSlots.end()) textureSlot = bindlessSlot->second;
+#endif
+    mDrawCalls.push_back({handle, static_cast<uint32_t>(constants.mOffset), textureSlot});
+    if(textureSlot != kInvalidBindlessSlot) return;
+
+    frameResources[currentFrameBufferIndex].textureImages.push_back(image);
 
-    frameResources[currentFrameBufferIndex].textureImageViews.push_back(mDevice.createImageView(viewInfo));
+    // the view lives as long as the texture so descriptor sets using it can be reused as they are.
+    frameResources[currentFrameBufferIndex].textureImageViews.push_back(mTextureViews[mMeshes[handle].texturePath]);
 }
 
 
@@ -312,7 +553,7 @@ void ThiefVKDevice::addSpotLights(std::vector<ThiefVKLight>& lights) {
 }
 
 
-void ThiefVKDevice::endFrameInternal() {
+void ThiefVKDevice::endFrameInternal(const uint64_t transferWaitValue) {
 	perFrameResources& resources = frameResources[currentFrameBufferIndex];
 	vk::CommandBuffer& primaryCmdBuffer = resources.primaryCmdBuffer;
 
@@ -345,15 +586,31 @@ void ThiefVKDevice::endFrameInternal() {
 	// Submit everything for this frame
 	std::array<vk::CommandBuffer, 2> cmdBuffers{resources.flushCommandBuffer, resources.primaryCmdBuffer};
 
+	std::vector<vk::Semaphore> waitSemaphores{resources.swapChainImageAvailable};
+	std::vector<vk::PipelineStageFlags> waitStages{vk::PipelineStageFlagBits::eTransfer};
+	std::vector<uint64_t> waitValues{0}; // ignored for binary semaphores
+
 	vk::SubmitInfo submitInfo{};
+#ifdef VK_KHR_timeline_semaphore
+	// only wait on the transfer queue if something drawn this frame is still being uploaded.
+	vk::TimelineSemaphoreSubmitInfoKHR timelineInfo{};
+	if(transferWaitValue > mTransferQueue.getCompletedValue()) {
+		waitSemaphores.push_back(mTransferQueue.getSemaphore());
+		waitStages.push_back(vk::PipelineStageFlagBits::eVertexInput);
+		waitValues.push_back(transferWaitValue);
+
+		timelineInfo.setWaitSemaphoreValueCount(waitValues.size());
+		timelineInfo.setPWaitSemaphoreValues(waitValues.data());
+		submitInfo.setPNext(&timelineInfo);
+	}
+#endif
 	submitInfo.setCommandBufferCount(cmdBuffers.size());
 	submitInfo.setPCommandBuffers(cmdBuffers.data());
-	submitInfo.setWaitSemaphoreCount(1);
-	submitInfo.setPWaitSemaphores(&resources.swapChainImageAvailable);
+	submitInfo.setWaitSemaphoreCount(waitSemaphores.size());
+	submitInfo.setPWaitSemaphores(waitSemaphores.data());
+	submitInfo.setPWaitDstStageMask(waitStages.data());
     submitInfo.setPSignalSemaphores(&resources.imageRendered);
     submitInfo.setSignalSemaphoreCount(1);
-	auto const waitStage = vk::PipelineStageFlags(vk::PipelineStageFlagBits::eTransfer);
-	submitInfo.setPWaitDstStageMask(&waitStage);
 
 	mGraphicsQueue.submit(submitInfo, resources.frameFinished);
 }
@@ -366,7 +623,7 @@ void ThiefVKDevice::swap() {
 }
 
 
-ThiefVKImage ThiefVKDevice::createImage(vk::Format format, vk::ImageUsageFlags usage, const uint32_t width, const uint32_t height) {
+vk::Image ThiefVKDevice::createImageHandle(vk::Format format, vk::ImageUsageFlags usage, const uint32_t width, const uint32_t height) {
     vk::ImageCreateInfo imageInfo{};
     imageInfo.setExtent({width, height, 1});
     imageInfo.setFormat(format);
@@ -377,13 +634,41 @@ ThiefVKImage ThiefVKDevice::createImage(vk::Format format, vk::ImageUsageFlags u
     imageInfo.setTiling(vk::ImageTiling::eOptimal);
     imageInfo.setUsage(usage);
 
-    vk::Image image = mDevice.createImage(imageInfo);
+    return mDevice.createImage(imageInfo);
+}
+
+
+ThiefVKImage ThiefVKDevice::createImage(vk::Format format, vk::ImageUsageFlags usage, const uint32_t width, const uint32_t height, const bool movable) {
+    vk::Image image = createImageHandle(format, usage, width, height);
     vk::MemoryRequirements imageMemRequirments = mDevice.getImageMemoryRequirements(image);
 
-    Allocation imageMemory = MemoryManager.Allocate(imageMemRequirments.size, imageMemRequirments.alignment, false); // we don't need to be able to map the image
+    Allocation imageMemory = MemoryManager.Allocate(imageMemRequirments, ThiefVKMemoryUsage::DeviceLocal, movable); // we don't need to be able to map the image
+    MemoryManager.BindImage(image, imageMemory);
+
+    return {image, imageMemory, format, usage, {width, height}};
+}
+
+
+// Render targets that are only ever read as input attachments within the render pass.
+// They're created transient so tilers can keep them in tile memory and only
+// commit memory for them if they have to.
+ThiefVKImage ThiefVKDevice::createRenderTarget(vk::Format format, vk::ImageUsageFlags usage, const uint32_t width, const uint32_t height) {
+    usage |= vk::ImageUsageFlagBits::eTransientAttachment;
+
+    vk::Image image = createImageHandle(format, usage, width, height);
+    vk::MemoryRequirements imageMemRequirments = mDevice.getImageMemoryRequirements(image);
+
+    Allocation imageMemory;
+    if(MemoryManager.SupportsLazilyAllocatedMemory(imageMemRequirments.memoryTypeBits)) {
+        imageMemory = MemoryManager.AllocateDedicated(imageMemRequirments, ThiefVKMemoryUsage::Transient, image);
+    } else if(MemoryManager.PrefersDedicatedAllocation(image)) {
+        imageMemory = MemoryManager.AllocateDedicated(imageMemRequirments, ThiefVKMemoryUsage::DeviceLocal, image);
+    } else {
+        imageMemory = MemoryManager.Allocate(imageMemRequirments, ThiefVKMemoryUsage::DeviceLocal);
+    }
     MemoryManager.BindImage(image, imageMemory);
 
-    return {image, imageMemory};
+    return {image, imageMemory, format, usage, {width, height}};
 }
 
 
@@ -394,22 +679,58 @@ void ThiefVKDevice::destroyImage(ThiefVKImage& image) {
 }
 
 
-ThiefVKBuffer ThiefVKDevice::createBuffer(const vk::BufferUsageFlags usage, const uint32_t size) {
+ThiefVKBuffer ThiefVKDevice::createBuffer(const vk::BufferUsageFlags usage, const uint64_t size, const ThiefVKMemoryUsage memoryUsage) {
+    if(size == 0) return ThiefVKBuffer{};
+    if(size > kSharedBufferBlockSize / 2) return createDedicatedBuffer(usage, size, memoryUsage);
+
+    auto sharedBuffers = mSharedBuffers.find({usage, memoryUsage});
+    if(sharedBuffers == mSharedBuffers.end()) {
+        // slices need to be alligned for any way they could be bound.
+        uint64_t allignment = 16;
+        if(usage & vk::BufferUsageFlagBits::eUniformBuffer) allignment = std::max<uint64_t>(allignment, mLimits.minUniformBufferOffsetAlignment);
+        if(usage & vk::BufferUsageFlagBits::eStorageBuffer) allignment = std::max<uint64_t>(allignment, mLimits.minStorageBufferOffsetAlignment);
+        if(usage & vk::BufferUsageFlagBits::eTransferSrc || usage & vk::BufferUsageFlagBits::eTransferDst)
+            allignment = std::max<uint64_t>(allignment, mLimits.optimalBufferCopyOffsetAlignment);
+
+        sharedBuffers = mSharedBuffers.try_emplace({usage, memoryUsage}, *this, usage, memoryUsage, allignment, kSharedBufferBlockSize).first;
+    }
+
+    ThiefVKBuffer buffer = sharedBuffers->second.allocate(size);
+    if(buffer.mBuffer == vk::Buffer(nullptr)) return createDedicatedBuffer(usage, size, memoryUsage);
+
+    return buffer;
+}
+
+
+ThiefVKBuffer ThiefVKDevice::createDedicatedBuffer(const vk::BufferUsageFlags usage, const uint64_t size, const ThiefVKMemoryUsage memoryUsage) {
 	vk::BufferCreateInfo bufferInfo{};
 	bufferInfo.setSize(size);
 	bufferInfo.setUsage(usage);
 	bufferInfo.setSharingMode(vk::SharingMode::eExclusive);
 
+    // shared with the transfer queue so uploads don't need a queue family ownership transfer.
+    if(mTransferQueue.isEnabled() && (usage & vk::BufferUsageFlagBits::eTransferDst)) {
+        bufferInfo.setSharingMode(vk::SharingMode::eConcurrent);
+        bufferInfo.setQueueFamilyIndexCount(mTransferQueue.getQueueFamilies().size());
+        bufferInfo.setPQueueFamilyIndices(mTransferQueue.getQueueFamilies().data());
+    }
+
 	vk::Buffer buffer = mDevice.createBuffer(bufferInfo);
     vk::MemoryRequirements bufferMemReqs = mDevice.getBufferMemoryRequirements(buffer);
 
 
-	Allocation bufferMem = MemoryManager.Allocate(size, bufferMemReqs.alignment,
-												  static_cast<uint32_t>(usage) & static_cast<uint32_t>(vk::BufferUsageFlagBits::eTransferSrc));
+	Allocation bufferMem = MemoryManager.Allocate(bufferMemReqs, memoryUsage);
+    if(bufferMem.getSize() == 0) {
+        mDevice.destroyBuffer(buffer);
+        return ThiefVKBuffer{};
+    }
 
 	MemoryManager.BindBuffer(buffer, bufferMem);
 
-    return {buffer, bufferMem};
+    ThiefVKBuffer dedicatedBuffer{buffer, bufferMem};
+    dedicatedBuffer.mSize = size;
+
+    return dedicatedBuffer;
 }
 
 
@@ -423,9 +744,14 @@ void ThiefVKDevice::DestroyBufferInternal(ThiefVKBuffer& buffer) {
         return;
     }
 
-	MemoryManager.Free(buffer.mBufferMemory);
+    if(buffer.mSubAllocator != nullptr) {
+        buffer.mSubAllocator->free(buffer); // might release the shared buffer straight away
+    } else {
+        MemoryManager.Free(buffer.mBufferMemory);
 
-	mDevice.destroyBuffer(buffer.mBuffer);
+        mDevice.destroyBuffer(buffer.mBuffer);
+        DescriptorManager.invalidateCachedWrites();
+    }
     buffer.mBuffer = vk::Buffer(nullptr);
 }
 
@@ -462,31 +788,90 @@ ThiefVKImage ThiefVKDevice::createTexture(const std::string& path) {
     stbi_uc* pixels = stbi_load(path.data(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
     vk::DeviceSize imageSize = texWidth * texHeight * 4;
 
-    ThiefVKBuffer stagingBuffer = createBuffer(vk::BufferUsageFlagBits::eTransferSrc, imageSize);
+    ThiefVKRingAllocation stagingMemory = getStagingMemory(imageSize);
 
-    void* data = MemoryManager.MapAllocation(stagingBuffer.mBufferMemory);
-    memcpy(data, pixels, imageSize);
-    MemoryManager.UnMapAllocation(stagingBuffer.mBufferMemory);
+    memcpy(stagingMemory.mMappedPointer, pixels, imageSize);
 
     stbi_image_free(pixels);
 
-    ThiefVKImage textureImage = createImage(vk::Format::eR8G8B8A8Unorm
-                                            ,vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, 
-                                            texWidth, texHeight);
+    ThiefVKImage textureImage = createImage(vk::Format::eR8G8B8A8Unorm // transfer src so that it can be moved by defragmentation
+                                            ,vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, 
+                                            texWidth, texHeight, true);
 
     transitionImageLayout(textureImage.mImage, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal);
-    CopybufferToImage(stagingBuffer.mBuffer, textureImage.mImage, texWidth, texHeight);
+    CopybufferToImage(stagingMemory.mBuffer, textureImage.mImage, texWidth, texHeight, stagingMemory.mOffset);
 
     transitionImageLayout(textureImage.mImage, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal); // we will sample from it next so transition the layout
 
-    frameResources[currentFrameBufferIndex].stagingBuffers.push_back(stagingBuffer);
-
 	mTextureCache[path] = textureImage;
+    mTextureViews[path] = createTextureView(textureImage);
+#if BINDLESS_TEXTURES
+    if(mBindlessEnabled) mBindlessTextureSlots[path] = addBindlessTexture(mTextureViews[path]);
+#endif
 
     return textureImage;
 }
 
 
+vk::ImageView ThiefVKDevice::createTextureView(const ThiefVKImage& texture) {
+    vk::ImageViewCreateInfo viewInfo{};
+    viewInfo.setImage(texture.mImage);
+    viewInfo.setFormat(texture.mFormat);
+    viewInfo.setViewType(vk::ImageViewType::e2D);
+    viewInfo.setSubresourceRange({vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+
+    return mDevice.createImageView(viewInfo);
+}
+
+
+void ThiefVKDevice::defragmentDeviceMemory(const uint64_t maxBytesToMove) {
+    MemoryManager.BeginDefragmentation();
+
+    uint64_t bytesMoved = 0;
+    for(auto& [path, texture] : mTextureCache) {
+        if(bytesMoved >= maxBytesToMove) break;
+        if(texture == ThiefVKImage{} || !MemoryManager.IsDefragmentationCandidate(texture.mImageMemory)) continue;
+
+        vk::Image image = createImageHandle(texture.mFormat, texture.mUsage, texture.mExtent.width, texture.mExtent.height);
+        vk::MemoryRequirements imageMemRequirments = mDevice.getImageMemoryRequirements(image);
+
+        Allocation imageMemory = MemoryManager.Reallocate(texture.mImageMemory, imageMemRequirments);
+        if(imageMemory.getSize() == 0) { // no room in the other pools, leave it where it is.
+            mDevice.destroyImage(image);
+            break;
+        }
+        MemoryManager.BindImage(image, imageMemory);
+
+        const ThiefVKImage movedTexture{image, imageMemory, texture.mFormat, texture.mUsage, texture.mExtent};
+        recordImageMove(texture, movedTexture);
+
+        // Frames still in flight may be sampling the old image.
+        mPendingFreeImages.push_back({currentSubmissionID, texture});
+        texture = movedTexture;
+
+        vk::ImageView& view = mTextureViews[path];
+        mPendingFreeImageViews.push_back({currentSubmissionID, view});
+        view = createTextureView(movedTexture);
+
+#if BINDLESS_TEXTURES
+        // the old slot could still be sampled by frames in flight, so the moved texture gets a new one.
+        if(mBindlessEnabled) {
+            uint32_t& slot = mBindlessTextureSlots[path];
+            if(slot != kInvalidBindlessSlot) mPendingFreeBindlessSlots.push_back({currentSubmissionID, slot});
+            slot = addBindlessTexture(view);
+        }
+#endif
+
+        bytesMoved += imageMemRequirments.size;
+    }
+}
+
+
+ThiefVKDefragmentationStats ThiefVKDevice::getDefragmentationStats() const {
+    return MemoryManager.GetDefragmentationStats();
+}
+
+
 vk::Fence ThiefVKDevice::createFence() {
     vk::FenceCreateInfo info{};
     return mDevice.createFence(info);
@@ -498,7 +883,7 @@ void ThiefVKDevice::destroyFence(vk::Fence& fence) {
 }
 
 
-vk::Sampler ThiefVKDevice::createSampler() {
+vk::SamplerCreateInfo ThiefVKDevice::getDefaultSamplerInfo() {
     vk::SamplerCreateInfo info{};
     info.setMagFilter(vk::Filter::eLinear);
     info.setMinFilter(vk::Filter::eLinear);
@@ -515,12 +900,37 @@ vk::Sampler ThiefVKDevice::createSampler() {
     info.setMinLod(0.0f);
     info.setMaxLod(0.0f);
 
-    return mDevice.createSampler(info);
+    return info;
 }
 
 
-void ThiefVKDevice::destroySampler(vk::Sampler& theSampler) {
-    mDevice.destroySampler(theSampler);
+size_t ThiefVKSamplerInfoHasher::operator()(const vk::SamplerCreateInfo& info) const {
+    const float floatState[4] = {info.mipLodBias, info.maxAnisotropy, info.minLod, info.maxLod};
+    const uint32_t state[12] = {static_cast<uint32_t>(info.flags), static_cast<uint32_t>(info.magFilter), static_cast<uint32_t>(info.minFilter),
+                                static_cast<uint32_t>(info.mipmapMode), static_cast<uint32_t>(info.addressModeU), static_cast<uint32_t>(info.addressModeV),
+                                static_cast<uint32_t>(info.addressModeW), info.anisotropyEnable, info.compareEnable, static_cast<uint32_t>(info.compareOp),
+                                static_cast<uint32_t>(info.borderColor), info.unnormalizedCoordinates};
+    uint64_t hash = ThiefVKHashBytes(state, sizeof(state));
+    hash = ThiefVKHashBytes(floatState, sizeof(floatState), hash);
+
+    return static_cast<size_t>(hash);
+}
+
+
+vk::Sampler ThiefVKDevice::getSampler(const vk::SamplerCreateInfo& info) {
+    // chained structs aren't part of the key.
+    vk::SamplerCreateInfo key = info;
+    key.setPNext(nullptr);
+
+    auto sampler = mSamplerCache.find(key);
+    if(sampler == mSamplerCache.end()) {
+        sampler = mSamplerCache.emplace(key, mDevice.createSampler(key)).first;
+#ifndef NDEBUG
+        std::cerr << "Created sampler " << mSamplerCache.size() << '\n';
+#endif
+    }
+
+    return sampler->second;
 }
 
 
@@ -528,47 +938,47 @@ void ThiefVKDevice::createDeferedRenderTargetImageViews() {
     ThiefVKImageTextutres Result{};
 
     for(unsigned int swapImageCount = 0; swapImageCount < mSwapChain.getNumberOfSwapChainImages(); ++swapImageCount) {
-        auto [colourImage, colourMemory]   = createImage(vk::Format::eR8G8B8A8Srgb, 
-                                                         vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eInputAttachment | vk::ImageUsageFlagBits::eSampled, 
+        ThiefVKImage colour  = createRenderTarget(vk::Format::eR8G8B8A8Srgb, 
+                                                         vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eInputAttachment, 
                                                          mSwapChain.getSwapChainImageWidth(), mSwapChain.getSwapChainImageHeight());
 
-        auto [depthImage , depthMemory]    = createImage(vk::Format::eD32Sfloat,
-                                                         vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eInputAttachment | vk::ImageUsageFlagBits::eSampled,
+        ThiefVKImage depth   = createRenderTarget(vk::Format::eD32Sfloat,
+                                                         vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eInputAttachment,
                                                          mSwapChain.getSwapChainImageWidth(), mSwapChain.getSwapChainImageHeight());
 
-        auto [normalsImage, normalsMemory] = createImage(vk::Format::eR8G8B8A8Srgb,
-                                                         vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eInputAttachment | vk::ImageUsageFlagBits::eSampled,
+        ThiefVKImage normals = createRenderTarget(vk::Format::eR8G8B8A8Srgb,
+                                                         vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eInputAttachment,
                                                          mSwapChain.getSwapChainImageWidth(), mSwapChain.getSwapChainImageHeight());
 
-        auto [albedoImage, albedoMemory] =  createImage(vk::Format::eR8G8B8A8Srgb,
-                                                         vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eInputAttachment | vk::ImageUsageFlagBits::eSampled,
+        ThiefVKImage albedo  = createRenderTarget(vk::Format::eR8G8B8A8Srgb,
+                                                         vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eInputAttachment,
                                                          mSwapChain.getSwapChainImageWidth(), mSwapChain.getSwapChainImageHeight());
 
 
                 
         vk::ImageViewCreateInfo colourViewInfo{};
-        colourViewInfo.setImage(colourImage);
+        colourViewInfo.setImage(colour.mImage);
         colourViewInfo.setViewType(vk::ImageViewType::e2D);
         colourViewInfo.setFormat(vk::Format::eR8G8B8A8Srgb);
         colourViewInfo.setComponents(vk::ComponentMapping()); // set swizzle components to identity
         colourViewInfo.setSubresourceRange(vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
 
         vk::ImageViewCreateInfo depthViewInfo{};
-        depthViewInfo.setImage(depthImage);
+        depthViewInfo.setImage(depth.mImage);
         depthViewInfo.setViewType(vk::ImageViewType::e2D);
         depthViewInfo.setFormat(vk::Format::eD32Sfloat);
         depthViewInfo.setComponents(vk::ComponentMapping());
         depthViewInfo.setSubresourceRange(vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1});
 
         vk::ImageViewCreateInfo normalsViewInfo{};
-        normalsViewInfo.setImage(normalsImage);
+        normalsViewInfo.setImage(normals.mImage);
         normalsViewInfo.setViewType(vk::ImageViewType::e2D);
         normalsViewInfo.setFormat(vk::Format::eR8G8B8A8Srgb);
         normalsViewInfo.setComponents(vk::ComponentMapping());
         normalsViewInfo.setSubresourceRange(vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
 
         vk::ImageViewCreateInfo albedoViewInfo{};
-        albedoViewInfo.setImage(albedoImage);
+        albedoViewInfo.setImage(albedo.mImage);
         albedoViewInfo.setViewType(vk::ImageViewType::e2D);
         albedoViewInfo.setFormat(vk::Format::eR8G8B8A8Srgb);
         albedoViewInfo.setComponents(vk::ComponentMapping());
@@ -580,21 +990,21 @@ void ThiefVKDevice::createDeferedRenderTargetImageViews() {
         vk::ImageView normalsImageView = mDevice.createImageView(normalsViewInfo);
         vk::ImageView albedoImageView  = mDevice.createImageView(albedoViewInfo);
 
-        Result.colourImage          = colourImage;
+        Result.colourImage          = colour.mImage;
         Result.colourImageView      = colourImageView;
-        Result.colourImageMemory    = colourMemory;
+        Result.colourImageMemory    = colour.mImageMemory;
 
-        Result.depthImage           = depthImage;
+        Result.depthImage           = depth.mImage;
         Result.depthImageView       = depthImageView;
-        Result.depthImageMemory     = depthMemory;
+        Result.depthImageMemory     = depth.mImageMemory;
 
-        Result.normalsImage         = normalsImage;
+        Result.normalsImage         = normals.mImage;
         Result.normalsImageView     = normalsImageView;
-        Result.normalsImageMemory   = normalsMemory;
+        Result.normalsImageMemory   = normals.mImageMemory;
 
-        Result.albedoImage          = albedoImage;
+        Result.albedoImage          = albedo.mImage;
         Result.albedoImageView      = albedoImageView;
-        Result.albedoImageMemory         = albedoMemory;
+        Result.albedoImageMemory         = albedo.mImageMemory;
 
         deferedTextures.push_back(Result);
     }
@@ -739,8 +1149,22 @@ void ThiefVKDevice::createRenderPasses() {
     albedoToCompositeDepen.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
     albedoToCompositeDepen.setDependencyFlags(vk::DependencyFlagBits::eByRegion);
 
+    // The composite pass reads every G-buffer attachment as an input attachment,
+    // including the depth buffer, so make all of the writes visible to it.
+    std::array<vk::SubpassDependency, 3> gBufferToInputDepens{};
+    for(uint32_t subpass = 0; subpass < gBufferToInputDepens.size(); ++subpass) {
+        gBufferToInputDepens[subpass].setSrcSubpass(subpass);
+        gBufferToInputDepens[subpass].setDstSubpass(3);
+        gBufferToInputDepens[subpass].setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eLateFragmentTests);
+        gBufferToInputDepens[subpass].setDstStageMask(vk::PipelineStageFlagBits::eFragmentShader);
+        gBufferToInputDepens[subpass].setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite);
+        gBufferToInputDepens[subpass].setDstAccessMask(vk::AccessFlagBits::eInputAttachmentRead);
+        gBufferToInputDepens[subpass].setDependencyFlags(vk::DependencyFlagBits::eByRegion);
+    }
+
     std::array<vk::SubpassDescription, 4> allSubpasses{colourPassDesc, normalsPassDesc, albedoPassDesc, compositPassDesc};
-    std::array<vk::SubpassDependency, 4>  allSubpassDependancies{implicitFirstDepen, colourToCompositeDepen, albedoToCompositeDepen, normalsToCompositeDepen};
+    std::array<vk::SubpassDependency, 7>  allSubpassDependancies{implicitFirstDepen, colourToCompositeDepen, albedoToCompositeDepen, normalsToCompositeDepen,
+                                                                 gBufferToInputDepens[0], gBufferToInputDepens[1], gBufferToInputDepens[2]};
 
     vk::RenderPassCreateInfo renderPassInfo{};
     renderPassInfo.setAttachmentCount(allAttachments.size());
@@ -781,6 +1205,10 @@ void ThiefVKDevice::createFrameBuffers() {
 
 	// Resize the per frame resource vector here so when we go to use it it will be valid to index in to it
 	frameResources.resize(frameBuffers.size());
+
+    // staging memory is split between the frames in flight.
+    mStagingRing.create(frameResources.size());
+    mUniformRing.create(frameResources.size());
 }
 
 
@@ -805,22 +1233,31 @@ void ThiefVKDevice::createCommandPools() {
 }
 
 
-vk::DescriptorPool ThiefVKDevice::createDescriptorPool() {
-    // crerate the descriptor set pools for uniform buffers and combined image samplers
+vk::DescriptorPool ThiefVKDevice::createDescriptorPool(const uint32_t maxSets) {
+    // crerate the descriptor set pools for uniform buffers and combined image samplers,
+    // enough of each for every set to be any of the sets the renderer uses.
     vk::DescriptorPoolSize uniformBufferDescPoolSize{};
     uniformBufferDescPoolSize.setType(vk::DescriptorType::eUniformBuffer);
-    uniformBufferDescPoolSize.setDescriptorCount(15); // start with 5 we can allways allocate another pool if we later need more.
+    uniformBufferDescPoolSize.setDescriptorCount(maxSets);
+
+    vk::DescriptorPoolSize dynamicUniformBufferDescPoolSize{};
+    dynamicUniformBufferDescPoolSize.setType(vk::DescriptorType::eUniformBufferDynamic);
+    dynamicUniformBufferDescPoolSize.setDescriptorCount(maxSets); // per draw constants
 
     vk::DescriptorPoolSize imageSamplerrDescPoolSize{};
     imageSamplerrDescPoolSize.setType(vk::DescriptorType::eCombinedImageSampler);
-    imageSamplerrDescPoolSize.setDescriptorCount(40); // start with 5 we can allways allocate another pool if we later need more.
+    imageSamplerrDescPoolSize.setDescriptorCount(maxSets);
+
+    vk::DescriptorPoolSize inputAttachmentDescPoolSize{};
+    inputAttachmentDescPoolSize.setType(vk::DescriptorType::eInputAttachment);
+    inputAttachmentDescPoolSize.setDescriptorCount(maxSets * 4); // 4 per composite set
 
-    std::array<vk::DescriptorPoolSize, 2> descPoolSizes{uniformBufferDescPoolSize, imageSamplerrDescPoolSize};
+    std::array<vk::DescriptorPoolSize, 4> descPoolSizes{uniformBufferDescPoolSize, dynamicUniformBufferDescPoolSize, imageSamplerrDescPoolSize, inputAttachmentDescPoolSize};
 
     vk::DescriptorPoolCreateInfo uniformBufferDescPoolInfo{};
-    uniformBufferDescPoolInfo.setPoolSizeCount(descPoolSizes.size()); // two pools one for uniform buffers and one for combined image samplers
+    uniformBufferDescPoolInfo.setPoolSizeCount(descPoolSizes.size()); // uniform buffers, combined image samplers and input attachments
     uniformBufferDescPoolInfo.setPPoolSizes(descPoolSizes.data());
-    uniformBufferDescPoolInfo.setMaxSets(15);
+    uniformBufferDescPoolInfo.setMaxSets(maxSets);
 
     return mDevice.createDescriptorPool(uniformBufferDescPoolInfo);
 }
@@ -831,6 +1268,122 @@ void ThiefVKDevice::destroyDescriptorPool(vk::DescriptorPool& pool) {
 }
 
 
+#if BINDLESS_TEXTURES
+bool ThiefVKDevice::createBindlessTextureTable() {
+    if(!deviceSupportsExtension(mPhysDev, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)) {
+        std::cerr << "BINDLESS_TEXTURES needs VK_EXT_descriptor_indexing, using a descriptor set per draw \n";
+        return false;
+    }
+
+    // ThiefVKInstance enables these whenever they are supported.
+    const auto features = mPhysDev.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+    const auto& indexingFeatures = features.get<vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+    if(!indexingFeatures.descriptorBindingPartiallyBound || !indexingFeatures.descriptorBindingSampledImageUpdateAfterBind ||
+       !indexingFeatures.descriptorBindingUpdateUnusedWhilePending) {
+        std::cerr << "Device is missing descriptor indexing features for BINDLESS_TEXTURES, using a descriptor set per draw \n";
+        return false;
+    }
+
+    const auto properties = mPhysDev.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceDescriptorIndexingPropertiesEXT>();
+    const auto& indexingProperties = properties.get<vk::PhysicalDeviceDescriptorIndexingPropertiesEXT>();
+    if(indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers < kMaxBindlessTextures ||
+       indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages < kMaxBindlessTextures) {
+        std::cerr << "Device can't bind " << kMaxBindlessTextures << " textures for BINDLESS_TEXTURES, using a descriptor set per draw \n";
+        return false;
+    }
+
+    vk::DescriptorSetLayoutBinding binding{};
+    binding.setBinding(0);
+    binding.setDescriptorType(vk::DescriptorType::eCombinedImageSampler);
+    binding.setDescriptorCount(kMaxBindlessTextures);
+    binding.setStageFlags(vk::ShaderStageFlagBits::eFragment);
+
+    // slots that aren't in use by a frame can be written while other frames are in flight.
+    const vk::DescriptorBindingFlagsEXT bindingFlags = vk::DescriptorBindingFlagBitsEXT::ePartiallyBound |
+                                                       vk::DescriptorBindingFlagBitsEXT::eUpdateAfterBind |
+                                                       vk::DescriptorBindingFlagBitsEXT::eUpdateUnusedWhilePending;
+    vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo{};
+    bindingFlagsInfo.setBindingCount(1);
+    bindingFlagsInfo.setPBindingFlags(&bindingFlags);
+
+    vk::DescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.setPNext(&bindingFlagsInfo);
+    layoutInfo.setFlags(vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT);
+    layoutInfo.setBindingCount(1);
+    layoutInfo.setPBindings(&binding);
+    mBindlessLayout = mDevice.createDescriptorSetLayout(layoutInfo);
+
+    vk::DescriptorPoolSize poolSize{};
+    poolSize.setType(vk::DescriptorType::eCombinedImageSampler);
+    poolSize.setDescriptorCount(kMaxBindlessTextures);
+
+    vk::DescriptorPoolCreateInfo poolInfo{};
+    poolInfo.setFlags(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT);
+    poolInfo.setPoolSizeCount(1);
+    poolInfo.setPPoolSizes(&poolSize);
+    poolInfo.setMaxSets(1);
+    mBindlessPool = mDevice.createDescriptorPool(poolInfo);
+
+    vk::DescriptorSetAllocateInfo allocInfo{};
+    allocInfo.setDescriptorPool(mBindlessPool);
+    allocInfo.setDescriptorSetCount(1);
+    allocInfo.setPSetLayouts(&mBindlessLayout);
+    mBindlessSet = mDevice.allocateDescriptorSets(allocInfo)[0];
+
+    mBindlessSampler = getSampler();
+
+    return true;
+}
+
+
+void ThiefVKDevice::destroyBindlessTextureTable() {
+    mDevice.destroyDescriptorPool(mBindlessPool);
+    mDevice.destroyDescriptorSetLayout(mBindlessLayout);
+}
+
+
+uint32_t ThiefVKDevice::addBindlessTexture(const vk::ImageView view) {
+    uint32_t slot;
+    if(!mFreeBindlessSlots.empty()) {
+        slot = mFreeBindlessSlots.back();
+        mFreeBindlessSlots.pop_back();
+    } else if(mBindlessSlotCount < kMaxBindlessTextures) {
+        slot = mBindlessSlotCount++;
+    } else {
+        std::cerr << "Bindless texture table full, drawing with a descriptor set per draw instead \n";
+        return kInvalidBindlessSlot;
+    }
+
+    vk::DescriptorImageInfo imageInfo{};
+    imageInfo.setSampler(mBindlessSampler);
+    imageInfo.setImageView(view);
+    imageInfo.setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+
+    vk::WriteDescriptorSet descWrite{};
+    descWrite.setDstSet(mBindlessSet);
+    descWrite.setDstBinding(0);
+    descWrite.setDstArrayElement(slot);
+    descWrite.setDescriptorCount(1);
+    descWrite.setDescriptorType(vk::DescriptorType::eCombinedImageSampler);
+    descWrite.setPImageInfo(&imageInfo);
+    mDevice.updateDescriptorSets(descWrite, {});
+
+    return slot;
+}
+
+
+void ThiefVKDevice::DestroyPendingBindlessTextures() {
+    auto stillPending = std::remove_if(mPendingFreeBindlessSlots.begin(), mPendingFreeBindlessSlots.end(), [this](auto& pendingSlot) {
+        if(pendingSlot.first > finishedSubmissionID) return false;
+
+        mFreeBindlessSlots.push_back(pendingSlot.second);
+        return true;
+    });
+    mPendingFreeBindlessSlots.erase(stillPending, mPendingFreeBindlessSlots.end());
+}
+#endif
+
+
 vk::CommandBuffer ThiefVKDevice::beginSingleUseGraphicsCommandBuffer() {
     vk::CommandBufferAllocateInfo allocInfo{};
     allocInfo.setCommandBufferCount(1);
@@ -886,17 +1439,122 @@ void ThiefVKDevice::transitionImageLayout(vk::Image& image, vk::ImageLayout oldL
 }
 
 
-void ThiefVKDevice::copyBuffers(vk::Buffer& SrcBuffer, vk::Buffer& DstBuffer, vk::DeviceSize size) {
+ThiefVKRingAllocation ThiefVKDevice::getStagingMemory(const uint64_t size) {
+    ThiefVKRingAllocation stagingMemory = mStagingRing.allocate(size, mLimits.optimalBufferCopyOffsetAlignment > 16 ? mLimits.optimalBufferCopyOffsetAlignment : 16);
+    if(stagingMemory.mBuffer != vk::Buffer(nullptr)) return stagingMemory;
+
+    // The ring is full for this frame (or the upload is huge), fall back to a
+    // dedicated staging buffer that is freed once the frame has finished.
+    ThiefVKBuffer stagingBuffer = createBuffer(vk::BufferUsageFlagBits::eTransferSrc, size, ThiefVKMemoryUsage::Upload);
+    frameResources[currentFrameBufferIndex].stagingBuffers.push_back(stagingBuffer);
+
+    return {stagingBuffer.mBuffer, stagingBuffer.mOffset, size, stagingBuffer.getMappedPointer()};
+}
+
+
+void ThiefVKDevice::recordImageMove(const ThiefVKImage& src, const ThiefVKImage& dst) {
+    vk::CommandBuffer& flushCmdBuffer = frameResources[currentFrameBufferIndex].flushCommandBuffer;
+
+    std::array<vk::ImageMemoryBarrier, 2> toTransferBarriers{};
+    toTransferBarriers[0].setOldLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+    toTransferBarriers[0].setNewLayout(vk::ImageLayout::eTransferSrcOptimal);
+    toTransferBarriers[0].setSrcAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferWrite);
+    toTransferBarriers[0].setDstAccessMask(vk::AccessFlagBits::eTransferRead);
+    toTransferBarriers[0].setImage(src.mImage);
+
+    toTransferBarriers[1].setOldLayout(vk::ImageLayout::eUndefined);
+    toTransferBarriers[1].setNewLayout(vk::ImageLayout::eTransferDstOptimal);
+    toTransferBarriers[1].setDstAccessMask(vk::AccessFlagBits::eTransferWrite);
+    toTransferBarriers[1].setImage(dst.mImage);
+
+    for(auto& barrier : toTransferBarriers) {
+        barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+        barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+        barrier.setSubresourceRange({vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+    }
+
+    flushCmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer,
+                                   vk::DependencyFlags{}, 0, nullptr, 0, nullptr, toTransferBarriers.size(), toTransferBarriers.data());
+
+    vk::ImageCopy copyInfo{};
+    copyInfo.setSrcSubresource({vk::ImageAspectFlagBits::eColor, 0, 0, 1});
+    copyInfo.setDstSubresource({vk::ImageAspectFlagBits::eColor, 0, 0, 1});
+    copyInfo.setExtent({src.mExtent.width, src.mExtent.height, 1});
+
+    flushCmdBuffer.copyImage(src.mImage, vk::ImageLayout::eTransferSrcOptimal, dst.mImage, vk::ImageLayout::eTransferDstOptimal, copyInfo);
+
+    vk::ImageMemoryBarrier toShaderReadBarrier{};
+    toShaderReadBarrier.setOldLayout(vk::ImageLayout::eTransferDstOptimal);
+    toShaderReadBarrier.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+    toShaderReadBarrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
+    toShaderReadBarrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+    toShaderReadBarrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    toShaderReadBarrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    toShaderReadBarrier.setImage(dst.mImage);
+    toShaderReadBarrier.setSubresourceRange({vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+
+    flushCmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader,
+                                   vk::DependencyFlags{}, 0, nullptr, 0, nullptr, 1, &toShaderReadBarrier);
+}
+
+
+void ThiefVKDevice::copyBuffers(vk::Buffer& SrcBuffer, vk::Buffer& DstBuffer, vk::DeviceSize size, vk::DeviceSize srcOffset, vk::DeviceSize dstOffset) {
     vk::BufferCopy copyInfo{};
     copyInfo.setSize(size);
+    copyInfo.setSrcOffset(srcOffset);
+    copyInfo.setDstOffset(dstOffset);
 
 	frameResources[currentFrameBufferIndex].flushCommandBuffer.copyBuffer(SrcBuffer, DstBuffer, copyInfo); // record these commands in to the flush buffer that will get submitted before any draw calls are made
 }
 
 
-void ThiefVKDevice::CopybufferToImage(vk::Buffer& srcBuffer, vk::Image& dstImage, uint32_t width, uint32_t height) {
+// Copies in to a buffer that earlier frames may still be reading from, so wait for those
+// reads before the copies and make the writes visible to whatever dstUsage says will read it.
+void ThiefVKDevice::copyBufferRegions(vk::Buffer& SrcBuffer, vk::Buffer& DstBuffer, const std::vector<vk::BufferCopy>& regions, const vk::BufferUsageFlags dstUsage) {
+    vk::PipelineStageFlags consumerStages{};
+    vk::AccessFlags consumerAccess{};
+    if(dstUsage & vk::BufferUsageFlagBits::eVertexBuffer) {
+        consumerStages |= vk::PipelineStageFlagBits::eVertexInput;
+        consumerAccess |= vk::AccessFlagBits::eVertexAttributeRead;
+    }
+    if(dstUsage & vk::BufferUsageFlagBits::eIndexBuffer) {
+        consumerStages |= vk::PipelineStageFlagBits::eVertexInput;
+        consumerAccess |= vk::AccessFlagBits::eIndexRead;
+    }
+    if(dstUsage & vk::BufferUsageFlagBits::eUniformBuffer) {
+        consumerStages |= vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader;
+        consumerAccess |= vk::AccessFlagBits::eUniformRead;
+    }
+    if(!consumerStages) consumerStages = vk::PipelineStageFlagBits::eTopOfPipe;
+
+    vk::CommandBuffer& flushCmdBuffer = frameResources[currentFrameBufferIndex].flushCommandBuffer;
+
+    // write after read, the dst access is only there so the transfer can also read
+    // buffers that were written by earlier uploads (when a buffer is grown).
+    vk::MemoryBarrier consumedBarrier{};
+    consumedBarrier.setSrcAccessMask(vk::AccessFlags{});
+    consumedBarrier.setDstAccessMask(vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite);
+
+    flushCmdBuffer.pipelineBarrier(consumerStages, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags{}, 1, &consumedBarrier, 0, nullptr, 0, nullptr);
+
+    flushCmdBuffer.copyBuffer(SrcBuffer, DstBuffer, regions);
+
+    vk::BufferMemoryBarrier uploadBarrier{};
+    uploadBarrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
+    uploadBarrier.setDstAccessMask(consumerAccess);
+    uploadBarrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    uploadBarrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    uploadBarrier.setBuffer(DstBuffer);
+    uploadBarrier.setOffset(0);
+    uploadBarrier.setSize(VK_WHOLE_SIZE);
+
+    flushCmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, consumerStages, vk::DependencyFlags{}, 0, nullptr, 1, &uploadBarrier, 0, nullptr);
+}
+
+
+void ThiefVKDevice::CopybufferToImage(vk::Buffer& srcBuffer, vk::Image& dstImage, uint32_t width, uint32_t height, vk::DeviceSize srcOffset) {
     vk::BufferImageCopy copyInfo{};
-    copyInfo.setBufferOffset(0);
+    copyInfo.setBufferOffset(srcOffset);
     copyInfo.setBufferImageHeight(0);
     copyInfo.setBufferRowLength(0);
 
@@ -924,11 +1582,21 @@ vk::CommandBuffer& ThiefVKDevice::startRecordingColourCmdBuffer() {
 	// start recording commands in to the buffer
 	colourCmdBuffer.begin(beginInfo);
 
+	const ThiefVKPipelineDescription pipelineDesc = getColourPipelineDescription(mBindlessEnabled ? kBindlessColourShader : kColourShader);
+
+	colourCmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelineManager.getPipeLine(pipelineDesc));
+
+	return colourCmdBuffer;
+}
+
+
+ThiefVKPipelineDescription ThiefVKDevice::getColourPipelineDescription(const char* fragmentShader) {
 	ThiefVKPipelineDescription pipelineDesc{};
 	pipelineDesc.vertexShaderName	 = "BasicTransform.vert.spv";
-	pipelineDesc.fragmentShaderName	 = "Colour.frag.spv";
+	pipelineDesc.fragmentShaderName	 = fragmentShader;
 	pipelineDesc.renderPass			 = mRenderPasses.RenderPass;
     pipelineDesc.subpassIndex        = 0;
+    pipelineDesc.vertexStreams       = PositionStream | AttributeStream;
 	pipelineDesc.renderTargetOffsetX = 0;
 	pipelineDesc.renderTargetOffsetY = 0;
 	pipelineDesc.renderTargetHeight  = mSwapChain.getSwapChainImageHeight();
@@ -936,9 +1604,7 @@ vk::CommandBuffer& ThiefVKDevice::startRecordingColourCmdBuffer() {
     pipelineDesc.useDepthTest        = true;
     pipelineDesc.useBackFaceCulling  = true;
 
-	colourCmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelineManager.getPipeLine(pipelineDesc));
-
-	return colourCmdBuffer;
+	return pipelineDesc;
 }
 
 
@@ -962,6 +1628,7 @@ vk::CommandBuffer& ThiefVKDevice::startRecordingAlbedoCmdBuffer() {
 	pipelineDesc.fragmentShaderName	 = "Albedo.frag.spv";
 	pipelineDesc.renderPass			 = mRenderPasses.RenderPass;
     pipelineDesc.subpassIndex        = 2;
+    pipelineDesc.vertexStreams       = PositionStream | AttributeStream;
 	pipelineDesc.renderTargetOffsetX = 0;
 	pipelineDesc.renderTargetOffsetY = 0;
 	pipelineDesc.renderTargetHeight  = mSwapChain.getSwapChainImageHeight();
@@ -1002,6 +1669,7 @@ vk::CommandBuffer& ThiefVKDevice::startRecordingNormalsCmdBuffer() {
 #endif
     pipelineDesc.renderPass			 = mRenderPasses.RenderPass;
     pipelineDesc.subpassIndex        = 1;
+    pipelineDesc.vertexStreams       = PositionStream | NormalStream;
 	pipelineDesc.renderTargetOffsetX = 0;
 	pipelineDesc.renderTargetOffsetY = 0;
 	pipelineDesc.renderTargetHeight  = mSwapChain.getSwapChainImageHeight();
@@ -1062,26 +1730,55 @@ void ThiefVKDevice::destroyPerFrameResources(perFrameResources& resources) {
     }
     resources.stagingBuffers.clear();
 
-    for(auto& imageView : resources.textureImageViews) {
-        mDevice.destroyImageView(imageView);
-    }
     resources.textureImageViews.clear();
 }
 
 
 void ThiefVKDevice::DestroyPendingBuffers() {
-    for(unsigned int i = 0; i < mPendingFreeBuffers.size(); ++i) {
-        auto& [submissionID, buffer] = mPendingFreeBuffers.back();
-        if(submissionID <= finishedSubmissionID) {
-            DestroyBufferInternal(buffer);
-            mPendingFreeBuffers.pop_back();
-        } else {
-            break;
-        }
+    // newest first, stopping at the first one a frame in flight could still be using.
+    while(!mPendingFreeBuffers.empty() && mPendingFreeBuffers.back().first <= finishedSubmissionID) {
+        ThiefVKBuffer buffer = mPendingFreeBuffers.back().second;
+        mPendingFreeBuffers.pop_back();
+        DestroyBufferInternal(buffer);
     }
 }
 
 
+void ThiefVKDevice::DestroyPendingTransferBuffers() {
+    if(mPendingTransferFreeBuffers.empty()) return;
+
+    const uint64_t completedValue = mTransferQueue.getCompletedValue();
+    auto stillPending = std::remove_if(mPendingTransferFreeBuffers.begin(), mPendingTransferFreeBuffers.end(), [this, completedValue](auto& pendingBuffer) {
+        if(pendingBuffer.first > completedValue) return false;
+
+        // a frame might have drawn with it since, so it still has to wait for that.
+        destroyBuffer(pendingBuffer.second);
+        return true;
+    });
+    mPendingTransferFreeBuffers.erase(stillPending, mPendingTransferFreeBuffers.end());
+}
+
+
+void ThiefVKDevice::DestroyPendingImages() {
+    auto stillPending = std::remove_if(mPendingFreeImages.begin(), mPendingFreeImages.end(), [this](auto& pendingImage) {
+        if(pendingImage.first > finishedSubmissionID) return false;
+
+        destroyImage(pendingImage.second);
+        return true;
+    });
+    mPendingFreeImages.erase(stillPending, mPendingFreeImages.end());
+
+    auto stillPendingViews = std::remove_if(mPendingFreeImageViews.begin(), mPendingFreeImageViews.end(), [this](auto& pendingView) {
+        if(pendingView.first > finishedSubmissionID) return false;
+
+        mDevice.destroyImageView(pendingView.second);
+        return true;
+    });
+    if(stillPendingViews != mPendingFreeImageViews.end()) DescriptorManager.invalidateCachedWrites();
+    mPendingFreeImageViews.erase(stillPendingViews, mPendingFreeImageViews.end());
+}
+
+
 void ThiefVKDevice::createSemaphores() {
     for(auto& resources : frameResources) {
         vk::SemaphoreCreateInfo semInfo{};
@@ -1103,11 +1800,12 @@ ThiefVKDescriptorSetDescription ThiefVKDevice::getDescriptorSetDescription(const
     uboDescriptorLayout.mDescriptor.mBinding = 0;
     uboDescriptorLayout.mDescriptor.mDescType = shader.find("Composite") != std::string::npos ? vk::DescriptorType::eUniformBuffer : vk::DescriptorType::eUniformBufferDynamic;
     uboDescriptorLayout.mDescriptor.mShaderStage  = shader.find("Composite") != std::string::npos ? vk::ShaderStageFlagBits::eFragment : vk::ShaderStageFlagBits::eVertex;
-    uboDescriptorLayout.mResource = shader.find("Composite") != std::string::npos ? &frameResources[currentFrameBufferIndex].spotLightBuffer.mBuffer : &frameResources[currentFrameBufferIndex].uniformBuffer.mBuffer;
+    uboDescriptorLayout.mResource = shader.find("Composite") != std::string::npos ? &frameResources[currentFrameBufferIndex].spotLightBuffer : &frameResources[currentFrameBufferIndex].uniformBuffer;
 
     descSets.push_back(uboDescriptorLayout);
 
-    if(shader.find("Colour") != std::string::npos) {
+    // the bindless colour shader gets its textures from the table.
+    if(shader.find("Colour") != std::string::npos && shader.find("Bindless") == std::string::npos) {
         ThiefVKDescriptorDescription imageSamplerDescriptorLayout{};
         imageSamplerDescriptorLayout.mDescriptor.mBinding = 1;
         imageSamplerDescriptorLayout.mDescriptor.mDescType = vk::DescriptorType::eCombinedImageSampler;
@@ -1116,10 +1814,11 @@ ThiefVKDescriptorSetDescription ThiefVKDevice::getDescriptorSetDescription(const
 
         descSets.push_back(imageSamplerDescriptorLayout);
     } else if(shader.find("Composite") != std::string::npos) {
+        // the G-buffer is transient so it can only be read as input attachments.
         for(unsigned int i = 1; i < 5; ++i) {
             ThiefVKDescriptorDescription imageSamplerDescriptorLayout{};
             imageSamplerDescriptorLayout.mDescriptor.mBinding = i;
-            imageSamplerDescriptorLayout.mDescriptor.mDescType = vk::DescriptorType::eCombinedImageSampler;
+            imageSamplerDescriptorLayout.mDescriptor.mDescType = vk::DescriptorType::eInputAttachment;
             imageSamplerDescriptorLayout.mDescriptor.mShaderStage = vk::ShaderStageFlagBits::eFragment;
             imageSamplerDescriptorLayout.mResource = [this, i]() -> vk::ImageView*{
                 switch(i) {
@@ -12,12 +12,17 @@
 #include "ThiefVKMemoryManager.hpp"
 #include "ThiefVKPipeLineManager.hpp"
 #include "ThiefVKBufferManager.hpp"
+#include "ThiefVKRingBuffer.hpp"
+#include "ThiefVKTransferQueue.hpp"
+#include "ThiefVKBufferSubAllocator.hpp"
 #include "ThiefVKDescriptorManager.hpp"
 #include "ThiefVKVertex.hpp"
 #include "ThiefVKModel.hpp"
 
 // std library includes
 #include <array>
+#include <map>
+#include <unordered_map>
 #include <vector>
 #include <string>
 #include <tuple>
@@ -52,6 +57,47 @@ struct ThiefVKRenderPasses{
 };
 
 
+// Vertex and index buffers shared by every registered mesh with the same geometry.
+struct ThiefVKMeshGeometry {
+    ThiefVKBuffer vertexBuffer;
+    ThiefVKBuffer indexBuffer;
+    uint64_t vertexCount;
+    uint32_t indexCount;
+    vk::IndexType indexType;
+    uint64_t checkHash; // a second hash with a different seed, to tell apart geometry whose first hash collides
+    uint32_t references;
+    uint64_t uploadValue; // transfer queue timeline value that has to be reached before it can be drawn, 0 if uploaded on the graphics queue
+};
+
+
+// Geometry that stays resident in device local memory until it's unregistered.
+struct ThiefVKMesh {
+    ThiefVKBuffer vertexBuffer;
+    ThiefVKBuffer indexBuffer;
+    uint64_t vertexCount;
+    uint32_t indexCount;
+    vk::IndexType indexType;
+    uint64_t geometryHash; // key in to mSharedGeometry
+    ThiefVKMeshGeometry* geometry; // which of the geometries with that hash it uses
+    uint64_t uploadValue;
+    glm::vec4 positionOffsetAndScale;
+    std::string texturePath;
+};
+
+
+// Hashes the fields rather than the struct so padding doesn't matter, keys have a null pNext.
+struct ThiefVKSamplerInfoHasher {
+    size_t operator()(const vk::SamplerCreateInfo&) const;
+};
+
+
+struct ThiefVKDrawCall {
+    ThiefVKMeshHandle mesh;
+    uint32_t uniformOffset; // offset of the draws constants in mUniformRing
+    uint32_t textureSlot;   // index in to the bindless texture table, kInvalidBindlessSlot if it needs its own set
+};
+
+
 struct perFrameResources {
 	vk::Fence frameFinished;
 
@@ -71,18 +117,16 @@ struct perFrameResources {
 	vk::CommandBuffer normalsCmdBuffer;
     vk::CommandBuffer compositeCmdBuffer;
 
-    ThiefVKBuffer vertexBuffer;
-    ThiefVKBuffer indexBuffer;
     ThiefVKBuffer uniformBuffer;
     ThiefVKBuffer spotLightBuffer; 
 
     std::vector<ThiefVKDescriptorSet> DescSets;
 };
 
-struct geometry;
-
 class ThiefVKDevice {
 public:
+    friend ThiefVKBufferSubAllocator; // releases its shared buffers through DestroyBufferInternal
+
     explicit ThiefVKDevice(std::pair<vk::PhysicalDevice, vk::Device>, vk::SurfaceKHR, GLFWwindow*);
     ~ThiefVKDevice();
 
@@ -93,34 +137,60 @@ public:
     void addSpotLights(std::vector<ThiefVKLight>&);
 
 	void transitionImageLayout(vk::Image& image, vk::ImageLayout oldLayout, vk::ImageLayout newLayout);
-	void CopybufferToImage(vk::Buffer& srcBuffer, vk::Image& dstImage, uint32_t width, uint32_t height);
-	void copyBuffers(vk::Buffer& SrcBuffer, vk::Buffer& DstBuffer, vk::DeviceSize size);
+	void CopybufferToImage(vk::Buffer& srcBuffer, vk::Image& dstImage, uint32_t width, uint32_t height, vk::DeviceSize srcOffset = 0);
+	void copyBuffers(vk::Buffer& SrcBuffer, vk::Buffer& DstBuffer, vk::DeviceSize size, vk::DeviceSize srcOffset = 0, vk::DeviceSize dstOffset = 0);
+	void copyBufferRegions(vk::Buffer& SrcBuffer, vk::Buffer& DstBuffer, const std::vector<vk::BufferCopy>& regions, const vk::BufferUsageFlags dstUsage);
+
+    // Staging memory that stays valid until the current frame has finished on the GPU.
+    ThiefVKRingAllocation getStagingMemory(const uint64_t size);
 
 	ThiefVKMemoryManager*	getMemoryManager() { return &MemoryManager; }
 	ThiefVKDescriptorManager* getDescriptorManager() { return &DescriptorManager;  }
 
+    // Meshes are uploaded once and then drawn by handle, the upload happens on the transfer queue
+    // if there is one, otherwise during the next frame.
+    ThiefVKMeshHandle registerMesh(const geometry& geom);
+    void unregisterMesh(const ThiefVKMeshHandle handle);
+
 	void startFrame();
-	void draw(const geometry& geom);
+	void draw(const ThiefVKMeshHandle mesh, const glm::mat4& object, const glm::mat4& camera, const glm::mat4& world);
 	void endFrame();
 	void swap();
 
-    ThiefVKImage createImage(vk::Format format, vk::ImageUsageFlags usage, const uint32_t width, const uint32_t height);
+    // movable images are moved by defragmentDeviceMemory, so they have to be in mTextureCache.
+    ThiefVKImage createImage(vk::Format format, vk::ImageUsageFlags usage, const uint32_t width, const uint32_t height, const bool movable = false);
     void destroyImage(ThiefVKImage& image);
 
-	ThiefVKBuffer createBuffer(const vk::BufferUsageFlags usage, const uint32_t size);
+    // Small buffers are sub allocated from large shared buffers with the same usage,
+    // so the returned buffer can have a non zero mOffset.
+	ThiefVKBuffer createBuffer(const vk::BufferUsageFlags usage, const uint64_t size, const ThiefVKMemoryUsage memoryUsage = ThiefVKMemoryUsage::DeviceLocal);
+	ThiefVKBuffer createDedicatedBuffer(const vk::BufferUsageFlags usage, const uint64_t size, const ThiefVKMemoryUsage memoryUsage = ThiefVKMemoryUsage::DeviceLocal);
 	void destroyBuffer(ThiefVKBuffer& buffer);
 
     ThiefVKImage createTexture(const std::string&);
 
+    // Moves textures out of the least used device local pool, at most maxBytesToMove
+    // per call so it can be run every frame without causing a hitch. Buffers are never
+    // moved, pools holding any are left alone.
+    void defragmentDeviceMemory(const uint64_t maxBytesToMove);
+    ThiefVKDefragmentationStats getDefragmentationStats() const;
+
     vk::Fence createFence();
     void destroyFence(vk::Fence&);
 
-    vk::Sampler createSampler();
-    void destroySampler(vk::Sampler&);
+    // Samplers are cached by their state and live as long as the device, so they don't need destroying.
+    static vk::SamplerCreateInfo getDefaultSamplerInfo();
+    vk::Sampler getSampler(const vk::SamplerCreateInfo& info = getDefaultSamplerInfo());
 
-    vk::DescriptorPool createDescriptorPool();
+    vk::DescriptorPool createDescriptorPool(const uint32_t maxSets);
     void destroyDescriptorPool(vk::DescriptorPool&);
 
+    // false if BINDLESS_TEXTURES is off or the device can't support the table.
+    bool bindlessTexturesEnabled() const { return mBindlessEnabled; }
+#if BINDLESS_TEXTURES
+    vk::DescriptorSetLayout getBindlessTextureLayout() const { return mBindlessLayout; }
+#endif
+
     void createDeferedRenderTargetImageViews();
     void createRenderPasses();
     void createFrameBuffers();
@@ -138,8 +208,24 @@ private:
     void DestroyAllImageTextures();
     void DestroyImageView(vk::ImageView& view);
     void DestroyImage(vk::Image&, Allocation);
+    void DestroyPendingImages();
+
+    vk::ImageView createTextureView(const ThiefVKImage& texture);
+    vk::Image createImageHandle(vk::Format format, vk::ImageUsageFlags usage, const uint32_t width, const uint32_t height);
+    ThiefVKImage createRenderTarget(vk::Format format, vk::ImageUsageFlags usage, const uint32_t width, const uint32_t height);
+    void      recordImageMove(const ThiefVKImage& src, const ThiefVKImage& dst);
+
+    void uploadPendingMeshes();
+
+#if BINDLESS_TEXTURES
+    bool createBindlessTextureTable(); // false if the device is missing anything the table needs
+    void destroyBindlessTextureTable();
+    uint32_t addBindlessTexture(const vk::ImageView view); // kInvalidBindlessSlot if the table is full
+    void DestroyPendingBindlessTextures();
+#endif
 
     void DestroyPendingBuffers();
+    void DestroyPendingTransferBuffers();
     void DestroyBufferInternal(ThiefVKBuffer&);
 
     void DestroyFrameBuffers();
@@ -148,13 +234,14 @@ private:
     void              endSingleUseGraphicsCommandBuffer(vk::CommandBuffer);
 
 	vk::CommandBuffer&  startRecordingColourCmdBuffer();
+    ThiefVKPipelineDescription getColourPipelineDescription(const char* fragmentShader);
 	vk::CommandBuffer&  startRecordingAlbedoCmdBuffer();
 	vk::CommandBuffer&  startRecordingNormalsCmdBuffer();
 	vk::CommandBuffer&  startRecordingCompositeCmdBuffer();
 
     void renderFrame();
     void startFrameInternal();
-    void endFrameInternal();
+    void endFrameInternal(const uint64_t transferWaitValue);
 
     void destroyPerFrameResources(perFrameResources&);
 
@@ -166,6 +253,8 @@ private:
     uint64_t currentSubmissionID;   // longer needed and can be freed.
     
     std::vector<std::pair<uint64_t, ThiefVKBuffer>> mPendingFreeBuffers;
+    std::vector<std::pair<uint64_t, ThiefVKBuffer>> mPendingTransferFreeBuffers; // waiting on a transfer queue value before going to mPendingFreeBuffers
+    std::vector<std::pair<uint64_t, ThiefVKImage>>  mPendingFreeImages; // images that have been moved by defragmentation
 
     size_t currentFrameBufferIndex;
 
@@ -173,15 +262,47 @@ private:
 
     ThiefVKMemoryManager MemoryManager;
 
-	ThiefVKBufferManager<glm::mat4> mUniformBufferManager;
-	ThiefVKBufferManager<Vertex>	mVertexBufferManager;
-    ThiefVKBufferManager<uint32_t>  mIndexBufferManager;
+    ThiefVKRingBuffer mStagingRing;
+
+    // per draw constants are written straight in to this and read with a dynamic offset.
+    ThiefVKRingBuffer mUniformRing;
+
+    ThiefVKTransferQueue mTransferQueue;
+
+    // one set of shared buffers per usage class.
+    std::map<std::pair<vk::BufferUsageFlags, ThiefVKMemoryUsage>, ThiefVKBufferSubAllocator> mSharedBuffers;
+
     ThiefVKBufferManager<ThiefVKLight> mSpotLightBufferManager;
 
 	ThiefVKDescriptorManager DescriptorManager;
 
+    std::vector<ThiefVKMesh> mMeshes;
+    std::vector<ThiefVKMeshHandle> mFreeMeshHandles;
+    std::unordered_multimap<uint64_t, ThiefVKMeshGeometry> mSharedGeometry; // keyed by a hash of the vertices and indicies
+    std::vector<std::pair<ThiefVKMeshGeometry*, geometry>> mPendingMeshUploads;
+    std::vector<ThiefVKDrawCall> mDrawCalls;
+
 	std::map<std::string, ThiefVKImage> mTextureCache;
 
+    std::unordered_map<vk::SamplerCreateInfo, vk::Sampler, ThiefVKSamplerInfoHasher> mSamplerCache;
+    std::map<std::string, vk::ImageView> mTextureViews; // recreated when defragmentation moves the texture
+    std::vector<std::pair<uint64_t, vk::ImageView>> mPendingFreeImageViews;
+
+    bool mBindlessEnabled = false;
+
+#if BINDLESS_TEXTURES
+    // one descriptor set holding a view of every resident texture, slots are only
+    // reused once the frames that could be sampling them have finished.
+    vk::DescriptorPool mBindlessPool;
+    vk::DescriptorSetLayout mBindlessLayout;
+    vk::DescriptorSet mBindlessSet;
+    vk::Sampler mBindlessSampler;
+    std::map<std::string, uint32_t> mBindlessTextureSlots;
+    uint32_t mBindlessSlotCount = 0;
+    std::vector<uint32_t> mFreeBindlessSlots;
+    std::vector<std::pair<uint64_t, uint32_t>> mPendingFreeBindlessSlots;
+#endif
+
     vk::SurfaceKHR mWindowSurface;
     GLFWwindow* mWindow;
 
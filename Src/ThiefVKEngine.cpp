@@ -28,8 +28,15 @@ void ThiefVKEngine::Init() {
 }
 
 
+// The first time a model is added its geometry is registered with the device,
+// after that only its handle and transforms are kept each frame.
 void ThiefVKEngine::addModelToScene(ThiefVKModel& model) {
-  mModels.push_back(model);
+  if(model.getMeshHandle() == kInvalidMeshHandle) {
+    model.setMeshHandle(mDevice.registerMesh(model.getGeometry()));
+  }
+
+  const geometry& geom = model.getGeometry();
+  mModels.push_back({model.getMeshHandle(), geom.object, geom.camera, geom.world});
 }
 
 
@@ -41,10 +48,10 @@ void ThiefVKEngine::addLightToScene(ThiefVKLight& light) {
 void ThiefVKEngine::renderScene() {
   mDevice.startFrame();
 
-  mDevice.setCurrentView(glm::inverse(mModels[0].getGeometry().camera * mModels[0].getGeometry().world));
+  mDevice.setCurrentView(glm::inverse(mModels[0].camera * mModels[0].world));
 
   for(auto& model : mModels) {
-    mDevice.draw(model.getGeometry());
+    mDevice.draw(model.mesh, model.object, model.camera, model.world);
   }
   mModels.clear();
 
@@ -7,6 +7,15 @@
 #include "ThiefVKModel.hpp"
 #include "ThiefVKCamera.hpp"
 
+// A registered mesh and where to draw it this frame.
+struct ThiefVKModelInstance {
+    ThiefVKMeshHandle mesh;
+    glm::mat4 object;
+    glm::mat4 camera;
+    glm::mat4 world;
+};
+
+
 class ThiefVKEngine {
 
 public:
@@ -23,7 +32,7 @@ private:
 	GLFWwindow* mWindow;
     ThiefVKInstance mInstance;
     ThiefVKDevice mDevice;
-    std::vector<ThiefVKModel> mModels;
+    std::vector<ThiefVKModelInstance> mModels;
     std::vector<ThiefVKLight> mLights;
 };
 
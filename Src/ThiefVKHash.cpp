@@ -0,0 +1,107 @@
+#include "ThiefVKHash.hpp"
+
+#include <cstring>
+
+namespace {
+
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9ull;
+constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+
+inline uint64_t rotateLeft(const uint64_t value, const int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+
+// unaligned loads, the compiler turns these in to a single mov.
+inline uint64_t read64(const unsigned char* ptr) {
+	uint64_t value;
+	std::memcpy(&value, ptr, sizeof(uint64_t));
+	return value;
+}
+
+
+inline uint32_t read32(const unsigned char* ptr) {
+	uint32_t value;
+	std::memcpy(&value, ptr, sizeof(uint32_t));
+	return value;
+}
+
+
+inline uint64_t round(uint64_t accumulator, const uint64_t input) {
+	accumulator += input * kPrime2;
+	accumulator = rotateLeft(accumulator, 31);
+	return accumulator * kPrime1;
+}
+
+
+inline uint64_t mergeRound(uint64_t accumulator, const uint64_t value) {
+	accumulator ^= round(0, value);
+	return accumulator * kPrime1 + kPrime4;
+}
+
+}
+
+
+uint64_t ThiefVKHashBytes(const void* data, const size_t size, const uint64_t seed) {
+	const unsigned char* ptr = static_cast<const unsigned char*>(data);
+	const unsigned char* const end = ptr + size;
+	uint64_t hash;
+
+	if(size >= 32) {
+		// four independent lanes so the multiplies can be in flight at the same time.
+		const unsigned char* const limit = end - 32;
+		uint64_t v1 = seed + kPrime1 + kPrime2;
+		uint64_t v2 = seed + kPrime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - kPrime1;
+
+		do {
+			v1 = round(v1, read64(ptr));
+			v2 = round(v2, read64(ptr + 8));
+			v3 = round(v3, read64(ptr + 16));
+			v4 = round(v4, read64(ptr + 24));
+			ptr += 32;
+		} while(ptr <= limit);
+
+		hash = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) + rotateLeft(v4, 18);
+		hash = mergeRound(hash, v1);
+		hash = mergeRound(hash, v2);
+		hash = mergeRound(hash, v3);
+		hash = mergeRound(hash, v4);
+	} else {
+		hash = seed + kPrime5;
+	}
+
+	hash += static_cast<uint64_t>(size);
+
+	while(ptr + 8 <= end) {
+		hash ^= round(0, read64(ptr));
+		hash = rotateLeft(hash, 27) * kPrime1 + kPrime4;
+		ptr += 8;
+	}
+
+	if(ptr + 4 <= end) {
+		hash ^= static_cast<uint64_t>(read32(ptr)) * kPrime1;
+		hash = rotateLeft(hash, 23) * kPrime2 + kPrime3;
+		ptr += 4;
+	}
+
+	while(ptr < end) {
+		hash ^= static_cast<uint64_t>(*ptr) * kPrime5;
+		hash = rotateLeft(hash, 11) * kPrime1;
+		++ptr;
+	}
+
+	// avalanche
+	hash ^= hash >> 33;
+	hash *= kPrime2;
+	hash ^= hash >> 29;
+	hash *= kPrime3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
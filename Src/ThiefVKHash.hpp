@@ -0,0 +1,11 @@
+#ifndef THIEFVKHASH_HPP
+#define THIEFVKHASH_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+// 64 bit xxHash (XXH64) over raw bytes. Fast enough to run over every buffer
+// entry each frame to find out what has changed.
+uint64_t ThiefVKHashBytes(const void* data, const size_t size, const uint64_t seed = 0);
+
+#endif
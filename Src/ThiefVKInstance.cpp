@@ -6,6 +6,7 @@
 #include <vector>
 #include <set>
 #include <algorithm>
+#include <cstring>
 #include <iostream>
 
 // system includes
@@ -39,15 +40,33 @@ const QueueIndicies getAvailableQueues(vk::SurfaceKHR windowSurface, vk::Physica
     int graphics = -1;
     int present  = -1;
     int compute  = -1;
+    int transfer = -1; // only set for a dedicated transfer family, so uploads can run alongside rendering
 
     std::vector<vk::QueueFamilyProperties> queueProperties = dev.getQueueFamilyProperties();
+    for(uint32_t i = 0; i < queueProperties.size(); i++) {
+        const vk::QueueFlags flags = queueProperties[i].queueFlags;
+        if(flags & vk::QueueFlagBits::eTransfer && !(flags & vk::QueueFlagBits::eGraphics) && !(flags & vk::QueueFlagBits::eCompute)) {
+            transfer = i;
+            break;
+        }
+    }
+
     for(uint32_t i = 0; i < queueProperties.size(); i++) {
         if(queueProperties[i].queueFlags & vk::QueueFlagBits::eGraphics) graphics = i;
         if(queueProperties[i].queueFlags & vk::QueueFlagBits::eCompute) compute = i;
         if(dev.getSurfaceSupportKHR(i, windowSurface)) present = i;
-        if(graphics != -1 && present != -1 && compute != -1) return {graphics, present, compute};
+        if(graphics != -1 && present != -1 && compute != -1) return {graphics, present, compute, transfer};
     }
-    return {graphics, present, compute};
+    return {graphics, present, compute, transfer};
+}
+
+
+bool deviceSupportsExtension(const vk::PhysicalDevice& dev, const char* extensionName) {
+    const auto extensions = dev.enumerateDeviceExtensionProperties();
+
+    return std::any_of(extensions.begin(), extensions.end(), [extensionName](const vk::ExtensionProperties& extension) {
+        return strcmp(extension.extensionName, extensionName) == 0;
+    });
 }
 
 
@@ -60,7 +79,11 @@ ThiefVKInstance::ThiefVKInstance(GLFWwindow* window) {
     appInfo.setApiVersion(VK_MAKE_VERSION(0, 1, 0));
     appInfo.setPEngineName("ThiefVK");
     appInfo.setEngineVersion(VK_MAKE_VERSION(0, 1, 0));
+#ifdef VK_API_VERSION_1_1
+    appInfo.setApiVersion(VK_API_VERSION_1_1); // for vkGetPhysicalDeviceMemoryProperties2, used to query the memory budget
+#else
     appInfo.setApiVersion(VK_API_VERSION_1_0);
+#endif
 
     uint32_t numExtensions = 0;
     const char* const* requiredExtensions = glfwGetRequiredInstanceExtensions(&numExtensions);
@@ -138,6 +161,7 @@ std::pair<vk::PhysicalDevice, vk::Device> ThiefVKInstance::findSuitableDevices(i
     float queuePriority = 1.0f;
 
     std::set<int> uniqueQueues{queueIndices.GraphicsQueueIndex, queueIndices.PresentQueueIndex, queueIndices.ComputeQueueIndex};
+    if(queueIndices.TransferQueueIndex != -1) uniqueQueues.insert(queueIndices.TransferQueueIndex);
     std::vector<vk::DeviceQueueCreateInfo> queueInfo{};
     for(auto& queueIndex : uniqueQueues) {
         vk::DeviceQueueCreateInfo info{};
@@ -147,18 +171,50 @@ std::pair<vk::PhysicalDevice, vk::Device> ThiefVKInstance::findSuitableDevices(i
         queueInfo.push_back(info);
     }
 
-    const char* deviceExtensions = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+    std::vector<const char*> deviceExtensions{VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+#ifdef VK_EXT_memory_budget
+    if(deviceSupportsExtension(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+#endif
 
     vk::PhysicalDeviceFeatures physicalFeatures{};
     physicalFeatures.geometryShader = GeometryWanted;
     physicalFeatures.setSamplerAnisotropy(true);
 
     vk::DeviceCreateInfo deviceInfo{};
-    deviceInfo.setEnabledExtensionCount(1);
-    deviceInfo.setPpEnabledExtensionNames(&deviceExtensions);
     deviceInfo.setQueueCreateInfoCount(uniqueQueues.size());
     deviceInfo.setPQueueCreateInfos(queueInfo.data());
     deviceInfo.setPEnabledFeatures(&physicalFeatures);
+
+#ifdef VK_KHR_timeline_semaphore
+    // used to track uploads on the transfer queue.
+    vk::PhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures{};
+    timelineFeatures.setTimelineSemaphore(true);
+    if(deviceSupportsExtension(physicalDevice, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+        deviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+        timelineFeatures.setPNext(const_cast<void*>(deviceInfo.pNext));
+        deviceInfo.setPNext(&timelineFeatures);
+    }
+#endif
+#if defined(VK_EXT_descriptor_indexing) && defined(VK_API_VERSION_1_1)
+    // lets every texture live in one partially bound array that can be updated while frames are in flight (BINDLESS_TEXTURES).
+    vk::PhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures{};
+    if(deviceSupportsExtension(physicalDevice, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)) {
+        const auto supportedFeatures = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+        const auto& supportedIndexing = supportedFeatures.get<vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+
+        descriptorIndexingFeatures.setDescriptorBindingPartiallyBound(supportedIndexing.descriptorBindingPartiallyBound);
+        descriptorIndexingFeatures.setDescriptorBindingSampledImageUpdateAfterBind(supportedIndexing.descriptorBindingSampledImageUpdateAfterBind);
+        descriptorIndexingFeatures.setDescriptorBindingUpdateUnusedWhilePending(supportedIndexing.descriptorBindingUpdateUnusedWhilePending);
+
+        deviceExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        descriptorIndexingFeatures.setPNext(const_cast<void*>(deviceInfo.pNext));
+        deviceInfo.setPNext(&descriptorIndexingFeatures);
+    }
+#endif
+
+    deviceInfo.setEnabledExtensionCount(deviceExtensions.size());
+    deviceInfo.setPpEnabledExtensionNames(deviceExtensions.data());
+
 #ifndef NDEBUG
     const char* validationLayers = "VK_LAYER_LUNARG_standard_validation";
     deviceInfo.setEnabledLayerCount(1);
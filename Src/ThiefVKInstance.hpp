@@ -22,10 +22,12 @@ struct QueueIndicies {
     int GraphicsQueueIndex;
     int PresentQueueIndex;
     int ComputeQueueIndex;
+    int TransferQueueIndex; // -1 if there is no transfer only family
 };
 
 
 const QueueIndicies getAvailableQueues(vk::SurfaceKHR windowSurface, vk::PhysicalDevice& dev);
+bool deviceSupportsExtension(const vk::PhysicalDevice& dev, const char* extensionName);
 
 class ThiefVKInstance {
 public:
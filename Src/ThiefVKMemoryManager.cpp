@@ -1,14 +1,19 @@
 #include "ThiefVKMemoryManager.hpp"
+#include "ThiefVKInstance.hpp"
 
 #include <vulkan/vulkan.hpp>
 
 #include <vector>
-#include <list>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <limits>
+#include <system_error>
+#include <unordered_map>
 
 bool operator<(const ThiefVKBuffer& lhs, const ThiefVKBuffer& rhs) {
-    return lhs.mBuffer < rhs.mBuffer;
+    // slices of the same shared buffer are different buffers
+    return lhs.mBuffer < rhs.mBuffer || (lhs.mBuffer == rhs.mBuffer && lhs.mOffset < rhs.mOffset);
 }
 
 bool operator==(const ThiefVKImage& lhs, const ThiefVKImage& rhs) {
@@ -21,311 +26,723 @@ bool operator!=(const ThiefVKImage& lhs, const ThiefVKImage& rhs) {
 }
 
 
-bool operator==(const PoolFragment& lhs, const PoolFragment& rhs) {
-    return lhs.DeviceLocal == rhs.DeviceLocal
-            && lhs.free == rhs.free
-            && lhs.offset == rhs.offset
-            && lhs.size == rhs.size;
+namespace {
+
+    struct MemoryUsageFlags {
+        vk::MemoryPropertyFlags required;
+        vk::MemoryPropertyFlags preferred;
+        vk::MemoryPropertyFlags avoided;
+    };
+
+
+    MemoryUsageFlags getUsageFlags(ThiefVKMemoryUsage usage) {
+        const vk::MemoryPropertyFlags hostCoherent = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+
+        switch(usage) {
+            case ThiefVKMemoryUsage::DeviceLocal:
+                return {vk::MemoryPropertyFlags{}, vk::MemoryPropertyFlagBits::eDeviceLocal,
+                        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eLazilyAllocated};
+            case ThiefVKMemoryUsage::Upload: // keep the small device local and host visible heap free for things that need it.
+                return {hostCoherent, vk::MemoryPropertyFlags{},
+                        vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostCached | vk::MemoryPropertyFlagBits::eLazilyAllocated};
+            case ThiefVKMemoryUsage::Readback:
+                return {hostCoherent, vk::MemoryPropertyFlagBits::eHostCached,
+                        vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eLazilyAllocated};
+            case ThiefVKMemoryUsage::DeviceLocalHostVisible:
+                return {hostCoherent, vk::MemoryPropertyFlagBits::eDeviceLocal,
+                        vk::MemoryPropertyFlagBits::eHostCached | vk::MemoryPropertyFlagBits::eLazilyAllocated};
+            case ThiefVKMemoryUsage::Transient:
+                return {vk::MemoryPropertyFlags{}, vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eLazilyAllocated,
+                        vk::MemoryPropertyFlagBits::eHostVisible};
+        }
+
+        return {};
+    }
+
+
+#if CONCURRENT_MEMORY_MANAGER
+    using MemoryLock = std::lock_guard<std::mutex>;
+
+    std::atomic<uint64_t> nextManagerID{1};
+#else
+    struct MemoryLock {
+        explicit MemoryLock(std::mutex&) {}
+    };
+#endif
+
+
+    int countSetBits(vk::MemoryPropertyFlags flags) {
+        uint32_t bits = static_cast<uint32_t>(flags);
+        int count = 0;
+        for(; bits != 0; bits &= bits - 1) ++count;
+
+        return count;
+    }
+
 }
 
 
-ThiefVKMemoryManager::ThiefVKMemoryManager(vk::PhysicalDevice* physDev, vk::Device *Dev) : PhysDev{physDev}, Device{Dev} {
-    findPoolIndicies();
+ThiefVKMemoryManager::ThiefVKMemoryManager(vk::PhysicalDevice* physDev, vk::Device *Dev) : mDefragmentationStats{}, PhysDev{physDev}, Device{Dev} {
+    mMemoryProperties = PhysDev->getMemoryProperties();
+#ifdef VK_EXT_memory_budget
+    mMemoryBudgetSupported = deviceSupportsExtension(*PhysDev, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+#else
+    mMemoryBudgetSupported = false;
+#endif
+#ifdef VK_API_VERSION_1_1
+    mDedicatedAllocationSupported = PhysDev->getProperties().apiVersion >= VK_API_VERSION_1_1;
+#else
+    mDedicatedAllocationSupported = false;
+#endif
+    for(auto& sourcePool : mDefragmentationSourcePools) sourcePool = ThiefVKTLSFAllocator::kInvalidBlock;
+#if CONCURRENT_MEMORY_MANAGER
+    mID = nextManagerID++;
+#endif
+
+    for(uint32_t memoryType = 0; memoryType < mMemoryProperties.memoryTypeCount; ++memoryType) {
+        const uint64_t heapSize = mMemoryProperties.memoryHeaps[mMemoryProperties.memoryTypes[memoryType].heapIndex].size;
 
-    AllocateDevicePool();
-    AllocateHostMappablePool();
+        // Don't let a single pool eat a small heap, e.g. a 256MB BAR heap.
+        const uint64_t poolSize = std::min<uint64_t>(256 * 1000000, heapSize / 8);
+        mMemoryTypePools[memoryType].config = {poolSize, poolSize, 300};
+    }
 }
 
 
 void ThiefVKMemoryManager::Destroy() {
-    FreeDevicePools();
-    FreeHostMappablePools();
+    MemoryLock lock{mMutex};
+
+#if CONCURRENT_MEMORY_MANAGER
+    mThreadCaches.clear(); // the pools are about to go so no need to give the allocations back
+    mID = nextManagerID++; // so threads don't find the caches that were just freed
+#endif
+    FreePools();
 }
 
 
-#if MEMORY_LOGGING
-    void ThiefVKMemoryManager::dumpPools() const {
-        std::cout << "Device local pools: \n";
-        for(auto& pool : deviceLocalPools) {
-            for(auto& fragment : pool) {
-                std::cout << "fragment size: " << fragment.size << '\n'
-                          << "fragment offset: " << fragment.offset << '\n'
-                          << "fragment marked for merge: " << fragment.canBeMerged << '\n'
-                          << "fragment free: " << fragment.free << "\n\n\n";
-            }
-        }
 
-        std::cout << "Host Mappable pools: \n";
-        for(auto& pool : hostMappablePools) {
-            for(auto& fragment : pool) {
-                std::cout << "fragment size: " << fragment.size << '\n'
-                          << "fragment offset: " << fragment.offset << '\n'
-                          << "fragment marked for merge: " << fragment.canBeMerged << '\n'
-                          << "fragment free: " << fragment.free << "\n\n\n";
-            }
+
+// Pick the memory type allowed by memoryTypeBits that has the most of the preferred
+// properties and the fewest of the ones we would rather avoid for this usage.
+uint32_t ThiefVKMemoryManager::findMemoryType(uint32_t memoryTypeBits, ThiefVKMemoryUsage usage) const {
+    const MemoryUsageFlags usageFlags = getUsageFlags(usage);
+
+    uint32_t bestType = VK_MAX_MEMORY_TYPES;
+    int bestScore = std::numeric_limits<int>::min();
+    for(uint32_t i = 0; i < mMemoryProperties.memoryTypeCount; ++i) {
+        if(!(memoryTypeBits & (1u << i))) continue;
+
+        const vk::MemoryPropertyFlags properties = mMemoryProperties.memoryTypes[i].propertyFlags;
+        if((properties & usageFlags.required) != usageFlags.required) continue;
+
+        const int score = countSetBits(properties & usageFlags.preferred) - countSetBits(properties & usageFlags.avoided);
+        if(score > bestScore) {
+            bestScore = score;
+            bestType = i;
         }
     }
+
+    return bestType;
+}
+
+
+bool ThiefVKMemoryManager::AllocatePool(uint32_t memoryType, uint64_t minimumSize) {
+    const auto& memoryTypePools = mMemoryTypePools[memoryType];
+
+    const bool firstPool = std::none_of(memoryTypePools.pools.begin(), memoryTypePools.pools.end(), [](const ThiefVKTLSFAllocator& pool) { return pool.getSize() != 0; });
+    const uint64_t configuredSize = firstPool ? memoryTypePools.config.initialPoolSize : memoryTypePools.config.growthPoolSize;
+
+    const uint64_t poolSize = std::max<uint64_t>(configuredSize, minimumSize);
+
+    vk::MemoryAllocateInfo allocInfo{poolSize, memoryType};
+
+    vk::DeviceMemory memory;
+    try {
+        memory = Device->allocateMemory(allocInfo);
+    }
+    catch(std::system_error&) {
+        std::cerr << "Failed to allocate a pool from memory type " << memoryType << '\n';
+        return false;
+    }
+
+    AddPool(memoryType, memory, poolSize, false);
+
+#ifndef NDEBUG
+    std::cerr << "Allocated a memory pool from memory type " << memoryType << '\n';
 #endif
 
+    return true;
+}
 
-void ThiefVKMemoryManager::findPoolIndicies() {
-    vk::PhysicalDeviceMemoryProperties memProps = PhysDev->getMemoryProperties();
 
-    bool poolFound = false;
-    for(uint32_t i = 0; i < memProps.memoryTypeCount; ++i) {
-        if(memProps.memoryTypes[i].propertyFlags & vk::MemoryPropertyFlagBits::eDeviceLocal
-           && !(memProps.memoryTypes[i].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent))
-        {
-            mDeviceLocalPoolIndex = i; // just find the find pool that is device local
-            poolFound = true;
-            break;
-        }
+uint32_t ThiefVKMemoryManager::AddPool(uint32_t memoryType, vk::DeviceMemory memory, uint64_t size, bool dedicated) {
+    char* mappedMemory = nullptr;
+    if(mMemoryProperties.memoryTypes[memoryType].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) {
+        mappedMemory = static_cast<char*>(Device->mapMemory(memory, 0, VK_WHOLE_SIZE));
     }
 
-    if(!poolFound) {
-        for(uint32_t i = 0; i < memProps.memoryTypeCount; ++i) {
-            if(memProps.memoryTypes[i].propertyFlags & vk::MemoryPropertyFlagBits::eDeviceLocal)
-            {
-                std::cerr << "having to use host coherint memory, probably a integrated GPU  \n";
-                mDeviceLocalPoolIndex = i; // just find the first pool that is device local
-                break;
-            }
-        }
+    // reuse the slot of a released pool if there is one.
+    auto& memoryTypePools = mMemoryTypePools[memoryType];
+    const auto releasedPool = std::find(memoryTypePools.memoryBackers.begin(), memoryTypePools.memoryBackers.end(), vk::DeviceMemory(nullptr));
+    if(releasedPool != memoryTypePools.memoryBackers.end()) {
+        const auto pool = static_cast<uint32_t>(std::distance(memoryTypePools.memoryBackers.begin(), releasedPool));
+        memoryTypePools.memoryBackers[pool] = memory;
+        memoryTypePools.mappedMemory[pool]  = mappedMemory;
+        memoryTypePools.pools[pool]         = ThiefVKTLSFAllocator(size);
+        memoryTypePools.dedicated[pool]     = dedicated;
+        memoryTypePools.movableAllocations[pool] = 0;
+        memoryTypePools.emptySinceFrame[pool] = mCurrentFrame;
+
+        return pool;
     }
 
-    for(uint32_t i = 0; i < memProps.memoryTypeCount; ++i) {
-        if((memProps.memoryTypes[i].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent)
-           && (memProps.memoryTypes[i]).propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
-        {
-            mHostMappablePoolIndex = i; // just find the find pool that is device local
-            break;
+    memoryTypePools.memoryBackers.push_back(memory);
+    memoryTypePools.mappedMemory.push_back(mappedMemory);
+    memoryTypePools.pools.emplace_back(size);
+    memoryTypePools.dedicated.push_back(dedicated);
+    memoryTypePools.movableAllocations.push_back(0);
+    memoryTypePools.emptySinceFrame.push_back(mCurrentFrame);
+
+    return static_cast<uint32_t>(memoryTypePools.pools.size() - 1);
+}
+
+
+void ThiefVKMemoryManager::ReleasePool(uint32_t memoryType, uint32_t pool) {
+    auto& memoryTypePools = mMemoryTypePools[memoryType];
+
+    if(memoryTypePools.mappedMemory[pool] != nullptr) Device->unmapMemory(memoryTypePools.memoryBackers[pool]);
+    Device->freeMemory(memoryTypePools.memoryBackers[pool]);
+
+    memoryTypePools.memoryBackers[pool] = vk::DeviceMemory(nullptr);
+    memoryTypePools.mappedMemory[pool]  = nullptr;
+    memoryTypePools.pools[pool]         = ThiefVKTLSFAllocator{};
+    memoryTypePools.dedicated[pool]     = false;
+
+    if(mDefragmentationSourcePools[memoryType] == pool) mDefragmentationSourcePools[memoryType] = ThiefVKTLSFAllocator::kInvalidBlock;
+
+#ifndef NDEBUG
+    std::cerr << "Released a memory pool from memory type " << memoryType << '\n';
+#endif
+}
+
+
+void ThiefVKMemoryManager::FreePools() {
+    for(auto& memoryTypePools : mMemoryTypePools) {
+        for(uint32_t i = 0; i < memoryTypePools.memoryBackers.size(); ++i) {
+            if(memoryTypePools.memoryBackers[i] == vk::DeviceMemory(nullptr)) continue;
+            if(memoryTypePools.mappedMemory[i] != nullptr) Device->unmapMemory(memoryTypePools.memoryBackers[i]);
+
+            Device->freeMemory(memoryTypePools.memoryBackers[i]);
         }
+        memoryTypePools.memoryBackers.clear();
+        memoryTypePools.mappedMemory.clear();
+        memoryTypePools.pools.clear();
+        memoryTypePools.dedicated.clear();
+        memoryTypePools.movableAllocations.clear();
+        memoryTypePools.emptySinceFrame.clear();
     }
-
-    
 }
 
 
-void ThiefVKMemoryManager::AllocateDevicePool() {
+Allocation ThiefVKMemoryManager::AllocateFromPool(uint64_t size, uint64_t allignment, uint32_t memoryType, uint32_t pool, bool movable) {
+    Allocation alloc;
+
+    const TLSFAllocation poolAlloc = mMemoryTypePools[memoryType].pools[pool].allocate(size, allignment);
+    if(poolAlloc.size == 0) {
+        alloc.size = 0; // signify that the allocation failed
+        return alloc;
+    }
 
-    vk::MemoryAllocateInfo allocInfo{256 * 1000000, static_cast<uint32_t>(mDeviceLocalPoolIndex)};
+    char* const mappedPool = mMemoryTypePools[memoryType].mappedMemory[pool];
 
-    deviceMemoryBackers.push_back(Device->allocateMemory(allocInfo));
+    alloc.offset = poolAlloc.offset;
+    alloc.mapped = mappedPool != nullptr ? mappedPool + poolAlloc.offset : nullptr;
+    alloc.block = poolAlloc.block;
+    alloc.memoryType = memoryType;
+    alloc.hostMappable = static_cast<bool>(mMemoryProperties.memoryTypes[memoryType].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible);
+    alloc.pool = pool;
+    alloc.size = size;
+    alloc.movable = movable;
+    alloc.cacheable = false;
 
-    std::list<PoolFragment> fragmentList(4);
-    uint64_t offset = 0;
-    for(auto& frag : fragmentList) {
-        frag.free = true;
-        frag.DeviceLocal = true;
-        frag.size = 64 * 1000000;
-        frag.offset = offset;
+    if(movable) ++mMemoryTypePools[memoryType].movableAllocations[pool];
 
-        offset += frag.size;
+    return alloc;
+}
+
+
+Allocation ThiefVKMemoryManager::AttemptToAllocate(uint64_t size, uint64_t allignment, uint32_t memoryType, bool useDefragmentationSource, bool movable) {
+    const uint32_t sourcePool = mDefragmentationSourcePools[memoryType];
+    const uint32_t poolCount  = static_cast<uint32_t>(mMemoryTypePools[memoryType].pools.size());
+
+    // keep new allocations out of a pool we're trying to empty.
+    for(uint32_t poolNum = 0; poolNum < poolCount; ++poolNum) {
+        if(poolNum == sourcePool || mMemoryTypePools[memoryType].dedicated[poolNum]) continue;
+
+        Allocation alloc = AllocateFromPool(size, allignment, memoryType, poolNum, movable);
+        if(alloc.size != 0) return alloc;
     }
 
-    deviceLocalPools.push_back(fragmentList);
+    if(useDefragmentationSource && sourcePool < poolCount) return AllocateFromPool(size, allignment, memoryType, sourcePool, movable);
 
-#ifndef NDEBUG
-    std::cerr << "Allocated a memory pool \n";
+    Allocation alloc;
+    alloc.size = 0; // signify that the allocation failed
+    return alloc;
+}
+
+
+Allocation ThiefVKMemoryManager::Allocate(const vk::MemoryRequirements& requirements, ThiefVKMemoryUsage usage, bool movable) {
+#if CONCURRENT_MEMORY_MANAGER
+    // movable allocations aren't cached, a recycled block would lose track of what owns it.
+    if(!movable && usage != ThiefVKMemoryUsage::Transient && requirements.size <= CacheClassSize(kCacheSizeClasses - 1)) {
+        // round up to a size class so the allocation can be recycled by any thread cache once freed.
+        const uint32_t sizeClass = CacheSizeClass(requirements.size);
+
+        vk::MemoryRequirements cachedRequirements = requirements;
+        cachedRequirements.size = CacheClassSize(sizeClass);
+
+        Allocation alloc;
+        const uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, usage); // memory properties never change so no lock needed
+        if(memoryType != VK_MAX_MEMORY_TYPES && AllocateFromThreadCache(memoryType, sizeClass, requirements.alignment, alloc)) return alloc;
+
+        MemoryLock lock{mMutex};
+        alloc = AllocateInternal(cachedRequirements, usage, false);
+        alloc.cacheable = alloc.size != 0;
+
+        return alloc;
+    }
 #endif
+
+    MemoryLock lock{mMutex};
+    return AllocateInternal(requirements, usage, movable);
 }
 
 
-void ThiefVKMemoryManager::AllocateHostMappablePool() {
+Allocation ThiefVKMemoryManager::AllocateInternal(const vk::MemoryRequirements& requirements, ThiefVKMemoryUsage usage, bool movable) {
+    if(usage == ThiefVKMemoryUsage::Transient) return AllocateDedicatedInternal(requirements, usage, vk::Image(nullptr));
 
-    vk::MemoryAllocateInfo allocInfo{256 * 1000000, static_cast<uint32_t>(mHostMappablePoolIndex)};
+    uint32_t allowedTypes = requirements.memoryTypeBits;
 
-    hostMappableMemoryBackers.push_back(Device->allocateMemory(allocInfo));
+    for(;;) {
+        const uint32_t memoryType = findMemoryType(allowedTypes, usage);
+        if(memoryType == VK_MAX_MEMORY_TYPES) break;
 
-    std::list<PoolFragment> fragmentList(4);
-    uint64_t offset = 0;
-    for(auto& frag : fragmentList) {
-        frag.free = true;
-        frag.DeviceLocal = true;
-        frag.size = 64 * 1000000;
-        frag.offset = offset;
+        Allocation alloc = AttemptToAllocate(requirements.size, requirements.alignment, memoryType, true, movable);
+        if(alloc.size != 0) return alloc;
 
-        offset += frag.size;
+        // Free blocks are merged as soon as they're freed, so if we failed there just isn't room.
+        if(AllocatePool(memoryType, requirements.size + requirements.alignment)) {
+            alloc = AttemptToAllocate(requirements.size, requirements.alignment, memoryType, false, movable);
+            if(alloc.size != 0) return alloc;
+        }
+
+        // The heap for this type is full, fall back to the next best type we're allowed.
+        allowedTypes &= ~(1u << memoryType);
     }
 
-    hostMappablePools.push_back(fragmentList);
+    std::cerr << "No suitable memory type has space for an allocation of " << requirements.size << " bytes \n";
 
-#ifndef NDEBUG
-    std::cerr << "Allocated a host mappable memory pool \n";
-#endif
+    Allocation alloc;
+    alloc.size = 0; // out of memory :(
+    return alloc;
 }
 
 
-void ThiefVKMemoryManager::FreeDevicePools() {
-    for(auto& frags : deviceMemoryBackers) {
-        Device->freeMemory(frags);
-    }
+Allocation ThiefVKMemoryManager::AllocateDedicated(const vk::MemoryRequirements& requirements, ThiefVKMemoryUsage usage, vk::Image dedicatedImage) {
+    MemoryLock lock{mMutex};
+    return AllocateDedicatedInternal(requirements, usage, dedicatedImage);
 }
 
 
-void ThiefVKMemoryManager::FreeHostMappablePools() {
-    for(auto& frags : hostMappableMemoryBackers) { // we assume that all has been unmapped
-        Device->freeMemory(frags);
+Allocation ThiefVKMemoryManager::AllocateDedicatedInternal(const vk::MemoryRequirements& requirements, ThiefVKMemoryUsage usage, vk::Image dedicatedImage) {
+    const uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, usage);
+    if(memoryType == VK_MAX_MEMORY_TYPES) {
+        std::cerr << "No suitable memory type for a dedicated allocation \n";
+
+        Allocation alloc;
+        alloc.size = 0;
+        return alloc;
+    }
+
+    vk::MemoryAllocateInfo allocInfo{requirements.size, memoryType};
+#ifdef VK_API_VERSION_1_1
+    vk::MemoryDedicatedAllocateInfo dedicatedInfo{dedicatedImage, vk::Buffer(nullptr)};
+    if(mDedicatedAllocationSupported && dedicatedImage != vk::Image(nullptr)) allocInfo.setPNext(&dedicatedInfo);
+#endif
+
+    vk::DeviceMemory memory;
+    try {
+        memory = Device->allocateMemory(allocInfo);
     }
+    catch(std::system_error&) {
+        if(usage == ThiefVKMemoryUsage::Transient) return AllocateInternal(requirements, ThiefVKMemoryUsage::DeviceLocal, false);
+        return AllocateInternal(requirements, usage, false);
+    }
+
+    const uint32_t pool = AddPool(memoryType, memory, requirements.size, true);
+
+    return AllocateFromPool(requirements.size, 1, memoryType, pool, false);
+}
+
+
+bool ThiefVKMemoryManager::PrefersDedicatedAllocation(const vk::Image& image) const {
+#ifdef VK_API_VERSION_1_1
+    if(!mDedicatedAllocationSupported) return false;
+
+    const auto requirements = Device->getImageMemoryRequirements2<vk::MemoryRequirements2, vk::MemoryDedicatedRequirements>(vk::ImageMemoryRequirementsInfo2{image});
+    const auto& dedicatedRequirements = requirements.get<vk::MemoryDedicatedRequirements>();
+
+    return dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+#else
+    return false;
+#endif
 }
 
 
-void ThiefVKMemoryManager::MergeFreePools() {
-    MergePool(deviceLocalPools);
-    MergePool(hostMappablePools);
+bool ThiefVKMemoryManager::SupportsLazilyAllocatedMemory(uint32_t memoryTypeBits) const {
+    const uint32_t memoryType = findMemoryType(memoryTypeBits, ThiefVKMemoryUsage::Transient);
+
+    return memoryType != VK_MAX_MEMORY_TYPES && (mMemoryProperties.memoryTypes[memoryType].propertyFlags & vk::MemoryPropertyFlagBits::eLazilyAllocated);
 }
 
 
-void ThiefVKMemoryManager::MergePool(std::vector<std::list<PoolFragment> > &pools) { // this is expensive on a a list so only call when really needed
-    for(auto& pool : pools) {
-        // loop forwards through all the fragments and mark any free fragments ajasent to a free fragment as can be merged
-#if MEMORY_LOGGING
-        const auto freeFragmentsPre = std::count_if(pool.begin(), pool.end(), [](auto& fragment){ return fragment.free; });
-        std::cout << "number of free fragments pre merge: " << freeFragmentsPre << '\n';
+void ThiefVKMemoryManager::Free(Allocation alloc) {
+#if CONCURRENT_MEMORY_MANAGER
+    if(alloc.cacheable && FreeToThreadCache(alloc)) return;
 #endif
-		bool fragmentFree = false;
-        for(auto& fragment : pool) {
-            
-            if(fragmentFree && fragment.free) {
-                fragment.canBeMerged = true;
-            }
 
-            if(fragment.free) {
-                fragmentFree = true;
-            } else { 
-                fragmentFree = false;
-            }
-        }
+    MemoryLock lock{mMutex};
+    FreeInternal(alloc);
+}
 
-        // Now loop backwards over the list and merge all fragments marked as can be merged
-        uint32_t sizeToAdd = 0;
-        bool fragmentMerged = false;
-        std::vector<std::list<PoolFragment>::reverse_iterator> fragmentsToRemove;
-        for(auto fragment = pool.rbegin(); fragment != pool.rend(); ++fragment) {
 
-            if(fragmentMerged) {
-                fragment->size += sizeToAdd;
-                sizeToAdd = 0;
-                fragmentMerged = false;
-            }
+void ThiefVKMemoryManager::FreeInternal(const Allocation& alloc) {
+    ThiefVKTLSFAllocator& pool = mMemoryTypePools[alloc.memoryType].pools[alloc.pool];
+    pool.free(alloc.block);
+    if(alloc.movable) --mMemoryTypePools[alloc.memoryType].movableAllocations[alloc.pool];
 
-            if(fragment->canBeMerged) {
-                sizeToAdd = fragment->size;
-                fragmentsToRemove.push_back(fragment);
-                fragmentMerged = true;
-            }
+    if(mMemoryTypePools[alloc.memoryType].dedicated[alloc.pool]) {
+        ReleasePool(alloc.memoryType, alloc.pool);
+        return;
+    }
+
+    if(!pool.empty()) return;
+
+    if(alloc.pool == mDefragmentationSourcePools[alloc.memoryType]) {
+        mDefragmentationStats.bytesReclaimed += pool.getSize();
+
+        ReleasePool(alloc.memoryType, alloc.pool);
+        return;
+    }
+
+    mMemoryTypePools[alloc.memoryType].emptySinceFrame[alloc.pool] = mCurrentFrame;
+}
+
+
+void ThiefVKMemoryManager::SetPoolConfig(uint32_t memoryType, const ThiefVKPoolConfig& config) {
+    MemoryLock lock{mMutex};
+    mMemoryTypePools[memoryType].config = config;
+}
+
+
+ThiefVKPoolConfig ThiefVKMemoryManager::GetPoolConfig(uint32_t memoryType) const {
+    MemoryLock lock{mMutex};
+    return mMemoryTypePools[memoryType].config;
+}
+
+
+void ThiefVKMemoryManager::TrimPools() {
+    MemoryLock lock{mMutex};
+
+    ++mCurrentFrame;
+
+#if CONCURRENT_MEMORY_MANAGER
+    if(mCurrentFrame % kThreadCacheFlushFrames == 0) FlushThreadCaches();
+#endif
+
+    for(uint32_t memoryType = 0; memoryType < mMemoryProperties.memoryTypeCount; ++memoryType) {
+        auto& memoryTypePools = mMemoryTypePools[memoryType];
+
+        uint32_t livePools = 0;
+        for(uint32_t pool = 0; pool < memoryTypePools.pools.size(); ++pool) {
+            if(memoryTypePools.pools[pool].getSize() != 0 && !memoryTypePools.dedicated[pool]) ++livePools;
         }
 
-        // One final loop over all the fragments to be removed in reverse to avoid a use after free
-        for(auto iter = fragmentsToRemove.rbegin(); iter != fragmentsToRemove.rend(); ++iter) {
-            pool.remove(**iter);
+        for(uint32_t pool = 0; pool < memoryTypePools.pools.size() && livePools > 1; ++pool) {
+            const ThiefVKTLSFAllocator& allocator = memoryTypePools.pools[pool];
+            if(allocator.getSize() == 0 || memoryTypePools.dedicated[pool] || !allocator.empty()) continue;
+            if(mCurrentFrame - memoryTypePools.emptySinceFrame[pool] < memoryTypePools.config.framesBeforeTrim) continue;
+
+            ReleasePool(memoryType, pool);
+            --livePools;
         }
-#if MEMORY_LOGGING
-        const auto freeFragmentsPost = std::count_if(pool.begin(), pool.end(), [](auto& fragment){ return fragment.free; });
-        std::cout << "number of free fragments post merge: " << freeFragmentsPost << '\n';
-#endif
     }
 }
 
 
-Allocation ThiefVKMemoryManager::AttemptToAllocate(uint64_t size, unsigned int allignment, bool hostMappable) {
-    auto& memPools = hostMappable ? hostMappablePools : deviceLocalPools;
-
-    uint32_t poolNum = 0;
-    for(auto& pool : memPools) {
-        for(auto fragIter = pool.begin(); fragIter != pool.end(); ++fragIter) {
-            PoolFragment frag = *fragIter;
-            if(frag.free && frag.size >= size) {
-                unsigned int allignedoffset = 0;
-                while((frag.offset  + allignedoffset) % allignment != 0) {
-                    ++allignedoffset;
-                    if(size + allignedoffset > frag.size) continue; // make sure there is enought size to be alligned
-                }
-                Allocation alloc;
-                alloc.offset = frag.offset + allignedoffset;
-                alloc.fragOffset = frag.offset;
-                alloc.hostMappable = hostMappable;
-                alloc.deviceLocal = true;
-                alloc.pool = poolNum;
-                alloc.size = size;
-
-                if(size + allignedoffset < (frag.size / 2)) { // we'd be wasting more than half the fragment, so split it up
-                    PoolFragment fragToInsert;
-                    fragToInsert.DeviceLocal = true;
-                    fragToInsert.free = true;
-                    fragToInsert.offset = frag.offset + size + allignedoffset;
-                    fragToInsert.size = frag.size - size - allignedoffset;
-
-                    fragIter->size = size + allignedoffset;
-                    pool.insert(fragIter, fragToInsert);
-                }
-                fragIter->free = false;
-                return alloc;
+void ThiefVKMemoryManager::BeginDefragmentation() {
+    MemoryLock lock{mMutex};
+
+    for(uint32_t memoryType = 0; memoryType < mMemoryProperties.memoryTypeCount; ++memoryType) {
+        const auto& memoryTypePools = mMemoryTypePools[memoryType];
+        const auto& pools = memoryTypePools.pools;
+
+        // Keep draining the current source, ReleasePool clears it once it's empty.
+        const uint32_t currentSource = mDefragmentationSourcePools[memoryType];
+        if(currentSource != ThiefVKTLSFAllocator::kInvalidBlock && memoryTypePools.movableAllocations[currentSource] != 0) continue;
+
+        // Pick the least used pool that only holds movable allocations, as long as it's
+        // less than half full and there is another pool for its allocations to go to.
+        // Anything else in it, e.g. a shared buffer, would stop it from ever emptying.
+        // Blocks sitting in the thread caches are non movable too, so nothing cached is ever in a new source.
+        uint32_t livePools = 0;
+        uint32_t sourcePool = ThiefVKTLSFAllocator::kInvalidBlock;
+        uint64_t sourceUsed = std::numeric_limits<uint64_t>::max();
+        for(uint32_t pool = 0; pool < pools.size(); ++pool) {
+            if(pools[pool].getSize() == 0 || memoryTypePools.dedicated[pool]) continue;
+            ++livePools;
+
+            if(pools[pool].getAllocationCount() == 0 || pools[pool].getAllocationCount() != memoryTypePools.movableAllocations[pool]) continue;
+
+            const uint64_t used = pools[pool].getSize() - pools[pool].getFreeSize();
+            if(used < pools[pool].getSize() / 2 && used < sourceUsed) {
+                sourcePool = pool;
+                sourceUsed = used;
             }
         }
-        ++poolNum;
+
+        mDefragmentationSourcePools[memoryType] = livePools > 1 ? sourcePool : ThiefVKTLSFAllocator::kInvalidBlock;
     }
+}
 
-    Allocation alloc;
-    alloc.size = 0; // signify that the allocation failed
-    return alloc;
+
+bool ThiefVKMemoryManager::IsDefragmentationCandidate(const Allocation& alloc) const {
+    MemoryLock lock{mMutex};
+    return alloc.movable && alloc.pool == mDefragmentationSourcePools[alloc.memoryType];
 }
 
 
-Allocation ThiefVKMemoryManager::Allocate(uint64_t size, unsigned allignment,  bool hostMappable) {
+ThiefVKDefragmentationStats ThiefVKMemoryManager::GetDefragmentationStats() const {
+    MemoryLock lock{mMutex};
+    return mDefragmentationStats;
+}
+
 
-    Allocation alloc = AttemptToAllocate(size, allignment, hostMappable);
-    if(alloc.size != 0) return alloc;
+Allocation ThiefVKMemoryManager::Reallocate(const Allocation& alloc, const vk::MemoryRequirements& requirements) {
+    MemoryLock lock{mMutex};
 
-    MergeFreePools(); // if we failed to allocate, perform a defrag of the pools and try again.
-    alloc = AttemptToAllocate(size, allignment, hostMappable);
-    if(alloc.size != 0) return alloc;
+    Allocation newAlloc = AttemptToAllocate(requirements.size, requirements.alignment, alloc.memoryType, false, alloc.movable);
 
-    if(hostMappable) {
-        AllocateHostMappablePool();
-    } else {
-        AllocateDevicePool();
+    if(newAlloc.size != 0) {
+        ++mDefragmentationStats.allocationsMoved;
+        mDefragmentationStats.bytesMoved += newAlloc.size;
     }
-    MergeFreePools();
-    return AttemptToAllocate(size, allignment, hostMappable); // should succeed or we are out of memory :(
+
+    return newAlloc;
 }
 
 
-void ThiefVKMemoryManager::Free(Allocation alloc) {
-    auto& pools = alloc.hostMappable ? hostMappablePools : deviceLocalPools ;
-    auto& pool  = pools[alloc.pool];
+void ThiefVKMemoryManager::BindBuffer(vk::Buffer &buffer, Allocation alloc) {
+    vk::DeviceMemory memory;
+    {
+        MemoryLock lock{mMutex}; // another thread could be adding a pool
+        memory = mMemoryTypePools[alloc.memoryType].memoryBackers[alloc.pool];
+    }
+    Device->bindBufferMemory(buffer, memory, alloc.offset);
+}
+
+
+void ThiefVKMemoryManager::BindImage(vk::Image &image, Allocation alloc) {
+    vk::DeviceMemory memory;
+    {
+        MemoryLock lock{mMutex};
+        memory = mMemoryTypePools[alloc.memoryType].memoryBackers[alloc.pool];
+    }
+    Device->bindImageMemory(image, memory, alloc.offset);
+}
+
+
+void ThiefVKMemoryManager::GetMemoryStats(ThiefVKMemoryStats& stats) const {
+    MemoryLock lock{mMutex};
+
+    stats.pools.clear();
+    stats.heaps.assign(mMemoryProperties.memoryHeapCount, ThiefVKHeapStats{});
+
+    for(uint32_t memoryType = 0; memoryType < mMemoryProperties.memoryTypeCount; ++memoryType) {
+        const auto& pools = mMemoryTypePools[memoryType].pools;
+        ThiefVKHeapStats& heap = stats.heaps[mMemoryProperties.memoryTypes[memoryType].heapIndex];
+
+        for(uint32_t pool = 0; pool < pools.size(); ++pool) {
+            if(pools[pool].getSize() == 0) continue; // released by defragmentation
+
+            ThiefVKPoolStats poolStats{};
+            poolStats.memoryType       = memoryType;
+            poolStats.pool             = pool;
+            poolStats.size             = pools[pool].getSize();
+            poolStats.freeBytes        = pools[pool].getFreeSize();
+            poolStats.usedBytes        = poolStats.size - poolStats.freeBytes;
+            poolStats.largestFreeBlock = pools[pool].getLargestFreeBlock();
+            poolStats.allocationCount  = pools[pool].getAllocationCount();
+            poolStats.freeBlockCount   = pools[pool].getFreeBlockCount();
+            poolStats.fragmentation    = poolStats.freeBytes != 0 ? 1.0f - float(poolStats.largestFreeBlock) / float(poolStats.freeBytes) : 0.0f;
 
-    for(auto& frag : pool) {
-        if(alloc.fragOffset == frag.offset)  {
-            frag.free = true;
+            heap.allocatedBytes += poolStats.size;
+            heap.usedBytes      += poolStats.usedBytes;
+
+            stats.pools.push_back(poolStats);
+        }
+    }
+
+    for(uint32_t heap = 0; heap < mMemoryProperties.memoryHeapCount; ++heap) {
+        stats.heaps[heap].size = mMemoryProperties.memoryHeaps[heap].size;
+
+        // Without the budget extension assume we can use 80% of the heap and that
+        // we're the only user of it.
+        stats.heaps[heap].budget = stats.heaps[heap].size * 8 / 10;
+        stats.heaps[heap].usage  = stats.heaps[heap].allocatedBytes;
+        stats.heaps[heap].budgetFromDriver = false;
+    }
+
+#ifdef VK_EXT_memory_budget
+    if(mMemoryBudgetSupported) {
+        const auto properties = PhysDev->getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2, vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+        const auto& budgetProperties = properties.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+
+        for(uint32_t heap = 0; heap < mMemoryProperties.memoryHeapCount; ++heap) {
+            stats.heaps[heap].budget = budgetProperties.heapBudget[heap];
+            stats.heaps[heap].usage  = budgetProperties.heapUsage[heap];
+            stats.heaps[heap].budgetFromDriver = true;
         }
     }
+#endif
 }
 
 
-void ThiefVKMemoryManager::BindBuffer(vk::Buffer &buffer, Allocation alloc) {
-    std::vector<vk::DeviceMemory> pools = alloc.hostMappable ? hostMappableMemoryBackers : deviceMemoryBackers ;
+void ThiefVKMemoryManager::WriteMemoryStatsJSON(std::ostream& out) const {
+    ThiefVKMemoryStats stats;
+    GetMemoryStats(stats);
+    const ThiefVKDefragmentationStats defragmentationStats = GetDefragmentationStats();
+
+    out << "{\n  \"heaps\": [";
+    for(uint32_t i = 0; i < stats.heaps.size(); ++i) {
+        const ThiefVKHeapStats& heap = stats.heaps[i];
+        out << (i == 0 ? "\n" : ",\n")
+            << "    {\"heap\": " << i
+            << ", \"size\": " << heap.size
+            << ", \"allocatedBytes\": " << heap.allocatedBytes
+            << ", \"usedBytes\": " << heap.usedBytes
+            << ", \"budget\": " << heap.budget
+            << ", \"usage\": " << heap.usage
+            << ", \"budgetFromDriver\": " << (heap.budgetFromDriver ? "true" : "false") << '}';
+    }
+    out << "\n  ],\n  \"pools\": [";
+    for(uint32_t i = 0; i < stats.pools.size(); ++i) {
+        const ThiefVKPoolStats& pool = stats.pools[i];
+        out << (i == 0 ? "\n" : ",\n")
+            << "    {\"memoryType\": " << pool.memoryType
+            << ", \"heap\": " << mMemoryProperties.memoryTypes[pool.memoryType].heapIndex
+            << ", \"pool\": " << pool.pool
+            << ", \"size\": " << pool.size
+            << ", \"usedBytes\": " << pool.usedBytes
+            << ", \"freeBytes\": " << pool.freeBytes
+            << ", \"largestFreeBlock\": " << pool.largestFreeBlock
+            << ", \"allocationCount\": " << pool.allocationCount
+            << ", \"freeBlockCount\": " << pool.freeBlockCount
+            << ", \"fragmentation\": " << pool.fragmentation << '}';
+    }
+    out << "\n  ],\n  \"defragmentation\": {"
+        << "\"allocationsMoved\": " << defragmentationStats.allocationsMoved
+        << ", \"bytesMoved\": " << defragmentationStats.bytesMoved
+        << ", \"bytesReclaimed\": " << defragmentationStats.bytesReclaimed << "}\n}\n";
+}
+
+
+#if CONCURRENT_MEMORY_MANAGER
+uint32_t ThiefVKMemoryManager::CacheSizeClass(uint64_t size) {
+    uint32_t sizeClass = 0;
+    while(CacheClassSize(sizeClass) < size) ++sizeClass;
 
-    Device->bindBufferMemory(buffer, pools[alloc.pool], alloc.offset);
+    return sizeClass;
 }
 
 
-void ThiefVKMemoryManager::BindImage(vk::Image &image, Allocation alloc) {
-    std::vector<vk::DeviceMemory> pools = alloc.hostMappable ? hostMappableMemoryBackers : deviceMemoryBackers ;
+ThiefVKMemoryManager::ThreadCache& ThiefVKMemoryManager::GetThreadCache() {
+    // one entry per manager this thread has used, IDs are never reused so entries
+    // for destroyed managers are never looked up again and are dropped on the next miss.
+    struct CacheRef {
+        ThreadCache*               cache = nullptr; // only used while the manager is alive
+        std::weak_ptr<ThreadCache> owner;           // expires once the manager frees its caches
+    };
+    thread_local std::unordered_map<uint64_t, CacheRef> caches;
+
+    auto it = caches.find(mID);
+    if(it == caches.end()) { // first use from this thread
+        // drop the entries for managers that have been destroyed since the last miss.
+        for(auto dead = caches.begin(); dead != caches.end();) {
+            if(dead->second.owner.expired()) dead = caches.erase(dead);
+            else ++dead;
+        }
+
+        MemoryLock lock{mMutex};
+        mThreadCaches.push_back(std::make_shared<ThreadCache>());
+
+        it = caches.emplace(mID, CacheRef{mThreadCaches.back().get(), mThreadCaches.back()}).first;
+    }
+
+    return *it->second.cache;
+}
+
+
+bool ThiefVKMemoryManager::AllocateFromThreadCache(uint32_t memoryType, uint32_t sizeClass, uint64_t allignment, Allocation& alloc) {
+    ThreadCache& cache = GetThreadCache();
+    std::lock_guard<std::mutex> cacheLock{cache.mutex};
 
-    Device->bindImageMemory(image, pools[alloc.pool], alloc.offset);
+    // the source may have been picked since these were cached, don't hand them back out.
+    const uint32_t sourcePool = mDefragmentationSourcePools[memoryType].load(std::memory_order_relaxed);
+
+    auto& freeAllocations = cache.freeAllocations[memoryType][sizeClass];
+    for(auto it = freeAllocations.rbegin(); it != freeAllocations.rend(); ++it) {
+        if(it->offset % allignment != 0 || it->pool == sourcePool) continue;
+
+        alloc = *it;
+        *it = freeAllocations.back();
+        freeAllocations.pop_back();
+
+        return true;
+    }
+
+    return false;
 }
 
 
-void* ThiefVKMemoryManager::MapAllocation(Allocation alloc) {
-	std::vector<vk::DeviceMemory> pools = alloc.hostMappable ? hostMappableMemoryBackers : deviceMemoryBackers;
+bool ThiefVKMemoryManager::FreeToThreadCache(const Allocation& alloc) {
+    const uint32_t sizeClass = CacheSizeClass(alloc.size);
+
+    ThreadCache& cache = GetThreadCache();
+    std::lock_guard<std::mutex> cacheLock{cache.mutex};
 
-	return Device->mapMemory(pools[alloc.pool], alloc.offset, alloc.size);
+    // give it straight back so the source can empty, only non movable allocations that
+    // fell back to the source get here.
+    if(alloc.pool == mDefragmentationSourcePools[alloc.memoryType].load(std::memory_order_relaxed)) return false;
+
+    auto& freeAllocations = cache.freeAllocations[alloc.memoryType][sizeClass];
+    if(freeAllocations.size() >= kMaxCachedAllocations) return false;
+
+    freeAllocations.push_back(alloc);
+    return true;
 }
 
 
-void ThiefVKMemoryManager::UnMapAllocation(Allocation alloc) {
-	std::vector<vk::DeviceMemory> pools = alloc.hostMappable ? hostMappableMemoryBackers : deviceMemoryBackers;
+void ThiefVKMemoryManager::FlushThreadCaches() {
+    for(auto& cache : mThreadCaches) {
+        std::lock_guard<std::mutex> cacheLock{cache->mutex};
 
-	Device->unmapMemory(pools[alloc.pool]);
+        for(uint32_t memoryType = 0; memoryType < mMemoryProperties.memoryTypeCount; ++memoryType) {
+            for(auto& freeAllocations : cache->freeAllocations[memoryType]) {
+                for(const Allocation& alloc : freeAllocations) FreeInternal(alloc);
+                freeAllocations.clear();
+            }
+        }
+    }
 }
+#endif
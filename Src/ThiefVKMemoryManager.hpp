@@ -3,36 +3,69 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ostream>
 #include <vector>
-#include <list>
 
-#define MEMORY_LOGGING 0
+#include "ThiefVKTLSFAllocator.hpp"
 
-struct PoolFragment {
-    friend class ThiefVKMemoryManager; // to allow this to be an opaque handle that only the memory manager can use
-    friend bool operator==(const PoolFragment&, const PoolFragment&);
-private:
-    uint64_t offset;
-    uint64_t size;
-    bool DeviceLocal;
-    bool free;
-    bool canBeMerged = false;
+// Makes allocating and freeing safe from any thread. Small allocations are then
+// recycled through per thread caches so the common path doesn't take the global lock.
+#define CONCURRENT_MEMORY_MANAGER 1
+
+// What the memory will be used for, this is used to pick the fastest memory type
+// that the resource is allowed to live in.
+enum class ThiefVKMemoryUsage {
+    DeviceLocal,            // only ever touched by the GPU
+    Upload,                 // written by the CPU and read by the GPU, e.g. staging buffers
+    Readback,               // written by the GPU and read back on the CPU
+    DeviceLocalHostVisible, // written directly by the CPU in to device local memory (resizable BAR), falls back to Upload
+    Transient               // attachments that never leave a render pass, lazily allocated where the device supports it
 };
 
 struct Allocation {
     friend class ThiefVKMemoryManager;
+
+    // Host mappable pools are mapped for their whole lifetime, so this pointer
+    // stays valid until the allocation is freed. nullptr if not host mappable.
+    void* getMappedPointer() const { return mapped; }
+
+    uint64_t getSize() const { return size; } // 0 if the allocation failed
+
 private:
     uint64_t size;
-    uint64_t fragOffset;
     uint64_t offset;
+    void*    mapped;
+    uint32_t block; // handle in to the pools allocator so we can free without searching
     uint32_t pool; // for if we end up allocating more than one pool
-    bool deviceLocal;
+    uint32_t memoryType;
     bool hostMappable;
+    bool movable; // the owner will move it when it's a defragmentation candidate
+    bool cacheable; // size is a thread cache size class so it can be recycled without locking
 };
 
+class ThiefVKBufferSubAllocator;
+
+// Either a dedicated buffer or a slice of a larger shared one, in which case
+// mBufferMemory is the memory of the whole shared buffer. Anything using the
+// buffer needs to add mOffset to its own offsets.
 struct ThiefVKBuffer {
     vk::Buffer mBuffer;
     Allocation mBufferMemory;
+
+    uint64_t mOffset = 0;
+    uint64_t mSize = 0;
+
+    ThiefVKBufferSubAllocator* mSubAllocator = nullptr; // nullptr for dedicated buffers
+    uint32_t mSharedBufferIndex = 0;  // which of the sub allocators shared buffers it's a slice of
+    uint32_t mSubAllocationBlock = 0;
+
+    void* getMappedPointer() const {
+        return mBufferMemory.getMappedPointer() != nullptr ? static_cast<char*>(mBufferMemory.getMappedPointer()) + mOffset : nullptr;
+    }
 };
 
 bool operator<(const ThiefVKBuffer&, const ThiefVKBuffer&);
@@ -40,60 +73,173 @@ bool operator<(const ThiefVKBuffer&, const ThiefVKBuffer&);
 struct ThiefVKImage {
     vk::Image mImage;
     Allocation mImageMemory;
+
+    // what the image was created with, so that it can be recreated if it needs moving.
+    vk::Format mFormat;
+    vk::ImageUsageFlags mUsage;
+    vk::Extent2D mExtent;
 };
 
 bool operator==(const ThiefVKImage&, const ThiefVKImage&);
 bool operator!=(const ThiefVKImage&, const ThiefVKImage&);
 
+// How pools are sized for a memory type and how long empty pools are kept around.
+struct ThiefVKPoolConfig {
+    uint64_t initialPoolSize;  // size of the first pool of a memory type
+    uint64_t growthPoolSize;   // size of every pool after that
+    uint32_t framesBeforeTrim; // empty pools are released after being empty for this many frames
+};
+
+struct ThiefVKDefragmentationStats {
+    uint32_t allocationsMoved;
+    uint64_t bytesMoved;
+    uint64_t bytesReclaimed; // memory given back to the driver after pools were emptied
+};
+
+struct ThiefVKPoolStats {
+    uint32_t memoryType;
+    uint32_t pool;
+    uint64_t size;
+    uint64_t usedBytes;
+    uint64_t freeBytes;
+    uint64_t largestFreeBlock;
+    uint32_t allocationCount;
+    uint32_t freeBlockCount;
+    float    fragmentation; // 1 - largestFreeBlock / freeBytes, 0 when all the free space is in one block
+};
+
+struct ThiefVKHeapStats {
+    uint64_t size;
+    uint64_t allocatedBytes; // bytes of pools we have allocated from this heap
+    uint64_t usedBytes;      // bytes of those pools that are handed out
+    uint64_t budget;         // how much this process can allocate before performance suffers
+    uint64_t usage;          // how much this process has allocated according to the driver
+    bool     budgetFromDriver; // false if VK_EXT_memory_budget is missing and budget/usage are estimated
+};
+
+struct ThiefVKMemoryStats {
+    std::vector<ThiefVKPoolStats> pools;
+    std::vector<ThiefVKHeapStats> heaps;
+};
+
 // This class will be used for keeping track of GPU allocations for buffers and
-// images. this will be done my maintaing2 pools of gpu memory, one device local
-// and the other host mappable. allocations will be handles a opaque types that
-// the caller will keep track of.
+// images. A set of pools is kept for each memory type the device exposes and each
+// pool is carved up by a TLSF allocator. Resources are placed in the best memory type
+// their requirements allow for how they will be used. Host visible pools are mapped
+// once when they are created and stay mapped until they are freed.
+// allocations will be handles a opaque types that the caller will keep track of.
+// With CONCURRENT_MEMORY_MANAGER every public function can be called from any thread.
 class ThiefVKMemoryManager {
 
 public:
     ThiefVKMemoryManager() = default; // constructor that doens't allocate pools
     explicit ThiefVKMemoryManager(vk::PhysicalDevice* , vk::Device* ); // one that does
 
-    Allocation Allocate(uint64_t size, unsigned allignment, bool deviceLocal);
+    // Movable allocations must be moved by their owner when IsDefragmentationCandidate says so.
+    Allocation Allocate(const vk::MemoryRequirements&, ThiefVKMemoryUsage, bool movable = false);
     void       Free(Allocation alloc);
 
+    // Gives a resource its own vk::DeviceMemory instead of a range of a pool. Transient
+    // allocations are always dedicated so that lazily allocated memory is only committed
+    // for the image that needs it.
+    Allocation AllocateDedicated(const vk::MemoryRequirements&, ThiefVKMemoryUsage, vk::Image dedicatedImage = vk::Image(nullptr));
+    bool       PrefersDedicatedAllocation(const vk::Image&) const;
+    bool       SupportsLazilyAllocatedMemory(uint32_t memoryTypeBits) const;
+
     void       BindImage(vk::Image& image, Allocation alloc);
     void       BindBuffer(vk::Buffer& buffer, Allocation alloc);
 
-	void*	   MapAllocation(Allocation alloc);
-	void	   UnMapAllocation(Allocation alloc);
-
     void       Destroy();
 
-#if MEMORY_LOGGING
-    void dumpPools() const;
-#endif
+    // Incremental defragmentation, for each memory type with more than one pool the
+    // least used pool that only holds movable allocations is picked as a source. The owner
+    // of each allocation in a source pool Reallocates it in to one of the other pools and
+    // copies it across, once the source pool is empty it is released back to the driver.
+    // A source is kept until it's released or has nothing movable left in it.
+    void       BeginDefragmentation();
+    bool       IsDefragmentationCandidate(const Allocation&) const;
+    Allocation Reallocate(const Allocation&, const vk::MemoryRequirements&); // never allocates a new pool, size 0 if there is no room
+
+    ThiefVKDefragmentationStats GetDefragmentationStats() const;
+
+    // Defaults to an eighth of the heap, up to 256MB, for both sizes. Allocations
+    // bigger than the configured size still get a pool big enough to hold them.
+    void              SetPoolConfig(uint32_t memoryType, const ThiefVKPoolConfig&);
+    ThiefVKPoolConfig GetPoolConfig(uint32_t memoryType) const;
+
+    // Call once a frame, releases pools that have been empty for longer than their
+    // memory types framesBeforeTrim. The last pool of each memory type is kept.
+    void       TrimPools();
+
+    // Fills in stats for every live pool and heap, the vectors are reused so
+    // this is cheap enough to call every frame.
+    void       GetMemoryStats(ThiefVKMemoryStats&) const;
+    void       WriteMemoryStatsJSON(std::ostream&) const;
 
 private:
-    void MergeFreePools();
-    void MergePool(std::vector<std::list<PoolFragment>>& pools);
+    struct MemoryTypePools {
+        std::vector<vk::DeviceMemory>     memoryBackers;
+        std::vector<char*>                mappedMemory; // persistent mappings, nullptr for non host visible pools
+        std::vector<ThiefVKTLSFAllocator> pools; // released pools are left in place with a size of 0 so pool indicies stay valid
+        std::vector<bool>                 dedicated; // holds a single dedicated allocation, released when it's freed
+        std::vector<uint32_t>             movableAllocations;
+        std::vector<uint64_t>             emptySinceFrame;
+
+        ThiefVKPoolConfig config;
+    };
 
-    Allocation AttemptToAllocate(uint64_t size, unsigned int allignment, bool deviceLocal);
+    // expect mMutex to already be held
+    Allocation AllocateInternal(const vk::MemoryRequirements&, ThiefVKMemoryUsage, bool movable);
+    Allocation AllocateDedicatedInternal(const vk::MemoryRequirements&, ThiefVKMemoryUsage, vk::Image dedicatedImage);
+    void       FreeInternal(const Allocation&);
 
-    void AllocateDevicePool();
-    void AllocateHostMappablePool();
+    Allocation AttemptToAllocate(uint64_t size, uint64_t allignment, uint32_t memoryType, bool useDefragmentationSource, bool movable);
+    Allocation AllocateFromPool(uint64_t size, uint64_t allignment, uint32_t memoryType, uint32_t pool, bool movable);
+    bool       AllocatePool(uint32_t memoryType, uint64_t minimumSize);
+    uint32_t   AddPool(uint32_t memoryType, vk::DeviceMemory memory, uint64_t size, bool dedicated);
+    void       ReleasePool(uint32_t memoryType, uint32_t pool);
 
-    void FreeDevicePools();
-    void FreeHostMappablePools();
+    void FreePools();
 
-    void findPoolIndicies();
+    uint32_t findMemoryType(uint32_t memoryTypeBits, ThiefVKMemoryUsage) const;
 
-    uint32_t mDeviceLocalPoolIndex;
-    uint32_t mHostMappablePoolIndex;
+    vk::PhysicalDeviceMemoryProperties mMemoryProperties;
+    bool mMemoryBudgetSupported;
+    bool mDedicatedAllocationSupported; // VK_KHR_dedicated_allocation is core in 1.1
+    std::array<MemoryTypePools, VK_MAX_MEMORY_TYPES> mMemoryTypePools;
 
-    std::vector<vk::DeviceMemory> deviceMemoryBackers;
-    std::vector<vk::DeviceMemory> hostMappableMemoryBackers;
-    std::vector<std::list<PoolFragment>>   deviceLocalPools;
-    std::vector<std::list<PoolFragment>>   hostMappablePools;
+    std::array<std::atomic<uint32_t>, VK_MAX_MEMORY_TYPES> mDefragmentationSourcePools; // read without the lock by the thread caches
+    uint64_t mCurrentFrame = 0;
+    ThiefVKDefragmentationStats mDefragmentationStats;
 
     vk::PhysicalDevice* PhysDev; // handles so we can allocate more memory withou having
     vk::Device*         Device;  // to call out to the main device instance
+
+    mutable std::mutex mMutex; // guards everything above
+
+#if CONCURRENT_MEMORY_MANAGER
+    // four size classes per power of two from 256 bytes to 64KB, so rounding
+    // up to a class wastes less than a quarter of the allocation.
+    static constexpr uint32_t kCacheSizeClasses     = 33;
+    static constexpr uint64_t CacheClassSize(uint32_t sizeClass) { return (4ull + sizeClass % 4) << (6 + sizeClass / 4); }
+    static uint32_t           CacheSizeClass(uint64_t size);
+    static constexpr uint32_t kMaxCachedAllocations = 32; // per size class, per memory type
+    static constexpr uint32_t kThreadCacheFlushFrames = 120; // so idle cached blocks don't stop pools being trimmed
+
+    // Recently freed small allocations for one thread, kept per memory type and size class.
+    struct ThreadCache {
+        std::mutex mutex; // only contended while the caches are being flushed
+        std::array<std::array<std::vector<Allocation>, kCacheSizeClasses>, VK_MAX_MEMORY_TYPES> freeAllocations;
+    };
+
+    ThreadCache& GetThreadCache();
+    bool         AllocateFromThreadCache(uint32_t memoryType, uint32_t sizeClass, uint64_t allignment, Allocation& alloc); // skips blocks in defragmentation sources
+    bool         FreeToThreadCache(const Allocation&); // false for blocks in defragmentation sources
+    void         FlushThreadCaches(); // expects mMutex to be held
+
+    uint64_t mID = 0; // caches are matched to managers by this rather than address
+    std::vector<std::shared_ptr<ThreadCache>> mThreadCaches; // shared so threads can tell when theirs have gone
+#endif
 };
 
 #endif
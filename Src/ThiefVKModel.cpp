@@ -7,6 +7,7 @@
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <vector>
 
 ThiefVKModel::ThiefVKModel(const std::string& objectFileName, const std::string& textureFileName) {
@@ -18,6 +19,7 @@ ThiefVKModel::ThiefVKModel(const std::string& objectFileName, const std::string&
 	tinyobj::LoadObj(&attrib, &shapes, &materials, nullptr, objectFileName.c_str());
 
 	std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+	std::vector<Vertex> verticies{};
 
 	for (const auto& shape : shapes) {
 	    for (const auto& index : shape.mesh.indices) {
@@ -49,8 +51,8 @@ ThiefVKModel::ThiefVKModel(const std::string& objectFileName, const std::string&
 			vertex.albedo = 0.2f;
 
 	        if (uniqueVertices.count(vertex) == 0) {
-	            uniqueVertices[vertex] = static_cast<uint32_t>(mGeometry.verticies.size());
-	            mGeometry.verticies.push_back(vertex);
+	            uniqueVertices[vertex] = static_cast<uint32_t>(verticies.size());
+	            verticies.push_back(vertex);
 	        }
 
 	        mGeometry.indicies.push_back(uniqueVertices[vertex]);
@@ -60,22 +62,28 @@ ThiefVKModel::ThiefVKModel(const std::string& objectFileName, const std::string&
 	mGeometry.texturePath = textureFileName;
 
 #ifndef NDEBUG
-	dumpBinaryVerticies("./chaletVerticies.bin");
+	dumpBinaryVerticies("./chaletVerticies.bin", verticies);
 	dumpBinaryIndicies("./chaletIndicies.bin");
 #endif
+
+	// quantize (if enabled) now so it's only ever done once per model.
+	mGeometry.verticies = packVertices(std::move(verticies), mGeometry.positionOffsetAndScale);
+	packIndicies();
 }
 
 
 ThiefVKModel::ThiefVKModel(const std::string& binaryVertexFilePath, const std::string& binaryIndexFilePath, const std::string& textureFilePath) {
 	std::ifstream binaryVertexFile{binaryVertexFilePath, std::ios::binary};
 	std::vector<char> binaryVertexData(std::istreambuf_iterator<char>(binaryVertexFile), std::istreambuf_iterator<char>{});
-	mGeometry.verticies.resize(binaryVertexData.size() / sizeof(Vertex));
-	std::memmove(mGeometry.verticies.data(), binaryVertexData.data(), binaryVertexData.size());
+	std::vector<Vertex> verticies(binaryVertexData.size() / sizeof(Vertex));
+	std::memmove(verticies.data(), binaryVertexData.data(), binaryVertexData.size());
+	mGeometry.verticies = packVertices(std::move(verticies), mGeometry.positionOffsetAndScale);
 
 	std::ifstream binaryIndexile{binaryIndexFilePath, std::ios::binary};
 	std::vector<char> binaryIndexData(std::istreambuf_iterator<char>(binaryIndexile), std::istreambuf_iterator<char>{});
 	mGeometry.indicies.resize(binaryIndexData.size() / sizeof(uint32_t));
 	std::memmove(mGeometry.indicies.data(), binaryIndexData.data(), binaryIndexData.size());
+	packIndicies();
 
 	mGeometry.texturePath = textureFilePath;
 }
@@ -111,12 +119,13 @@ void ThiefVKModel::addVertexShaderOverride(const std::string) {
 }
 
 
-void ThiefVKModel::dumpBinaryVerticies(const std::string& filePath) const {
+// dumps the full precision vertices, so the binary files don't depend on COMPACT_VERTICES.
+void ThiefVKModel::dumpBinaryVerticies(const std::string& filePath, const std::vector<Vertex>& verticies) const {
 	std::ofstream binaryFile{};
 	binaryFile.open(filePath,  std::ofstream::binary);
 
-	const char* vertexData = reinterpret_cast<const char*>(mGeometry.verticies.data());
-	const size_t vertexSize = mGeometry.verticies.size() * sizeof(Vertex);
+	const char* vertexData = reinterpret_cast<const char*>(verticies.data());
+	const size_t vertexSize = verticies.size() * sizeof(Vertex);
 	for(unsigned int i = 0;i < vertexSize; ++i) {
 		binaryFile << vertexData[i];
 	}
@@ -137,6 +146,16 @@ void ThiefVKModel::dumpBinaryIndicies(const std::string& filePath) const {
 }
 
 
+// Switch to 16 bit indicies if every vertex can be addressed with them.
+void ThiefVKModel::packIndicies() {
+	if(mGeometry.verticies.size() > std::numeric_limits<uint16_t>::max() + 1) return;
+
+	mGeometry.shortIndicies.assign(mGeometry.indicies.begin(), mGeometry.indicies.end());
+	mGeometry.indicies.clear();
+	mGeometry.indicies.shrink_to_fit();
+}
+
+
 bool operator==(const ThiefVKLight& lhs, const ThiefVKLight& rhs) {
 	return lhs.mPosition == rhs.mPosition &&
 		   lhs.mDirection == rhs.mDirection &&
@@ -6,15 +6,26 @@
 
 #include "ThiefVKVertex.hpp"
 
+// Refers to a mesh that has been registered with and is resident on the device.
+using ThiefVKMeshHandle = uint32_t;
+constexpr ThiefVKMeshHandle kInvalidMeshHandle = ~0u;
+
 struct geometry {
-	std::vector<Vertex> verticies;
+	std::vector<MeshVertex> verticies;
     std::vector<uint32_t> indicies;
+    std::vector<uint16_t> shortIndicies; // used instead of indicies when there are few enough vertices
+	glm::vec4 positionOffsetAndScale{0.0f, 0.0f, 0.0f, 1.0f}; // bounds for compact vertex positions
 
 	glm::mat4 object; // These will be pushed to a uniform buffer
 	glm::mat4 camera;
 	glm::mat4 world;
 
 	std::string texturePath;
+
+	uint32_t		getIndexCount() const { return shortIndicies.empty() ? static_cast<uint32_t>(indicies.size()) : static_cast<uint32_t>(shortIndicies.size()); }
+	vk::IndexType	getIndexType() const { return shortIndicies.empty() ? vk::IndexType::eUint32 : vk::IndexType::eUint16; }
+	const void*		getIndexData() const { return shortIndicies.empty() ? static_cast<const void*>(indicies.data()) : static_cast<const void*>(shortIndicies.data()); }
+	uint64_t		getIndexDataSize() const { return indicies.size() * sizeof(uint32_t) + shortIndicies.size() * sizeof(uint16_t); }
 };
 
 
@@ -29,14 +40,19 @@ public:
 	void setCameraMatrix(const glm::mat4&);
 	void setWorldMatrix(const glm::mat4&);
 
+	ThiefVKMeshHandle getMeshHandle() const { return mMeshHandle; }
+	void setMeshHandle(const ThiefVKMeshHandle handle) { mMeshHandle = handle; }
+
 	void addFragmentShaderOverride(const std::string shaderName);
 	void addVertexShaderOverride(const std::string shaderName);
 
 private:
-	void dumpBinaryVerticies(const std::string& filePath) const;
+	void dumpBinaryVerticies(const std::string& filePath, const std::vector<Vertex>& verticies) const;
 	void dumpBinaryIndicies(const std::string& filePath) const;
+	void packIndicies();
 
 	geometry mGeometry;
+	ThiefVKMeshHandle mMeshHandle = kInvalidMeshHandle;
 };
 
 
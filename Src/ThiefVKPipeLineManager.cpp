@@ -36,6 +36,16 @@ vk::Pipeline ThiefVKPipelineManager::getPipeLine(ThiefVKPipelineDescription desc
     }
     vertexStage.setModule(shaderModules[description.vertexShaderName]);
 
+    // constant 0 tells the vertex shaders the normals are octahedral encoded, shaders without it ignore it.
+    const VkBool32 octahedralNormals = COMPACT_VERTICES;
+    vk::SpecializationMapEntry octahedralNormalsEntry{0, 0, sizeof(VkBool32)};
+    vk::SpecializationInfo vertexSpecialization{};
+    vertexSpecialization.setMapEntryCount(1);
+    vertexSpecialization.setPMapEntries(&octahedralNormalsEntry);
+    vertexSpecialization.setDataSize(sizeof(VkBool32));
+    vertexSpecialization.setPData(&octahedralNormals);
+    vertexStage.setPSpecializationInfo(&vertexSpecialization);
+
     vk::PipelineShaderStageCreateInfo fragStage{};
     fragStage.setStage(vk::ShaderStageFlagBits::eFragment);
     fragStage.setPName("main");
@@ -57,14 +67,14 @@ vk::Pipeline ThiefVKPipelineManager::getPipeLine(ThiefVKPipelineDescription desc
 
     vk::PipelineShaderStageCreateInfo shaderStages[3] = {vertexStage, fragStage, geomStage};
 
-    auto bindingDesc = Vertex::getBindingDesc();
-    auto attribDesc  = Vertex::getAttribDesc();
+    auto bindingDesc = Vertex::getBindingDesc(description.vertexStreams);
+    auto attribDesc  = Vertex::getAttribDesc(description.vertexStreams);
 
     vk::PipelineVertexInputStateCreateInfo vertexInputInfo{};
     vertexInputInfo.setVertexAttributeDescriptionCount(attribDesc.size());
     vertexInputInfo.setPVertexAttributeDescriptions(attribDesc.data());
-    vertexInputInfo.setVertexBindingDescriptionCount(1);
-    vertexInputInfo.setPVertexBindingDescriptions(&bindingDesc);
+    vertexInputInfo.setVertexBindingDescriptionCount(bindingDesc.size());
+    vertexInputInfo.setPVertexBindingDescriptions(bindingDesc.data());
 
     vk::PipelineVertexInputStateCreateInfo compositeVertexInputInfo{};
     compositeVertexInputInfo.setVertexAttributeDescriptionCount(0);
@@ -167,9 +177,9 @@ vk::ShaderModule ThiefVKPipelineManager::createShaderModule(std::string& path) c
 
 
 vk::PipelineLayout ThiefVKPipelineManager::createPipelineLayout(vk::DescriptorSetLayout& descLayouts, std::string& name)  const {
+    std::vector<vk::DescriptorSetLayout> setLayouts{descLayouts};
+
     vk::PipelineLayoutCreateInfo pipelinelayoutinfo{};
-    pipelinelayoutinfo.setPSetLayouts(&descLayouts);
-    pipelinelayoutinfo.setSetLayoutCount(1);
 
     vk::PushConstantRange range{};
     if(name.find("Composite") != std::string::npos) {
@@ -180,6 +190,22 @@ vk::PipelineLayout ThiefVKPipelineManager::createPipelineLayout(vk::DescriptorSe
         pipelinelayoutinfo.setPushConstantRangeCount(1);
         pipelinelayoutinfo.setPPushConstantRanges(&range);
     }
+#if BINDLESS_TEXTURES
+    else if(name.find("ColourBindless") != std::string::npos) {
+        // only used when the device has the table. The texture table is set 1 and the push constant is the draws index in to it.
+        setLayouts.push_back(dev.getBindlessTextureLayout());
+
+        range.setStageFlags(vk::ShaderStageFlagBits::eFragment);
+        range.setOffset(0);
+        range.setSize(sizeof(uint32_t));
+
+        pipelinelayoutinfo.setPushConstantRangeCount(1);
+        pipelinelayoutinfo.setPPushConstantRanges(&range);
+    }
+#endif
+
+    pipelinelayoutinfo.setPSetLayouts(setLayouts.data());
+    pipelinelayoutinfo.setSetLayoutCount(setLayouts.size());
 
     return dev.getLogicalDevice()->createPipelineLayout(pipelinelayoutinfo);
 }
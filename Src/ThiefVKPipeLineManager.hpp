@@ -2,6 +2,7 @@
 #define THIEFVKPIPELINEMANAGER_HPP
 
 #include "ThiefVKDescriptorManager.hpp"
+#include "ThiefVKVertex.hpp"
 
 #include <map> // used for a runtime pipeline cache
 #include <string>
@@ -24,6 +25,7 @@ struct ThiefVKPipelineDescription {
     int32_t renderTargetOffsetY;
     bool    useDepthTest;
     bool    useBackFaceCulling;
+    uint32_t vertexStreams = AllStreams; // which VertexStreams the vertex shader reads
 };
 
 bool operator<(const ThiefVKPipelineDescription&, const ThiefVKPipelineDescription&);
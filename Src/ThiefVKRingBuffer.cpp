@@ -0,0 +1,48 @@
+#include "ThiefVKRingBuffer.hpp"
+
+#include "ThiefVKDevice.hpp"
+
+
+ThiefVKRingBuffer::ThiefVKRingBuffer(ThiefVKDevice& Device, vk::BufferUsageFlags usage, uint64_t sizePerFrame, ThiefVKMemoryUsage memoryUsage) :
+	mDevice{Device},
+	mUsage{usage},
+	mSizePerFrame{sizePerFrame},
+	mMemoryUsage{memoryUsage},
+	mBuffer{},
+	mMappedMemory{nullptr},
+	mCurrentOffset{0},
+	mFrameEnd{0} {}
+
+
+void ThiefVKRingBuffer::create(uint32_t framesInFlight) {
+	// the frame buffers can be recreated, e.g. along with the swap chain.
+	if(mBuffer.mBuffer != vk::Buffer(nullptr)) destroy();
+
+	mBuffer = mDevice.createDedicatedBuffer(mUsage, mSizePerFrame * framesInFlight, mMemoryUsage);
+	mMappedMemory = static_cast<char*>(mBuffer.getMappedPointer());
+
+	beginFrame(0);
+}
+
+
+void ThiefVKRingBuffer::destroy() {
+	mDevice.destroyBuffer(mBuffer); // frames in flight can still be reading it, so this is deferred
+	mBuffer = ThiefVKBuffer{};
+	mMappedMemory = nullptr;
+}
+
+
+void ThiefVKRingBuffer::beginFrame(uint32_t frameIndex) {
+	mCurrentOffset = frameIndex * mSizePerFrame;
+	mFrameEnd = mCurrentOffset + mSizePerFrame;
+}
+
+
+ThiefVKRingAllocation ThiefVKRingBuffer::allocate(uint64_t size, uint64_t allignment) {
+	const uint64_t offset = ((mCurrentOffset + allignment - 1) / allignment) * allignment;
+	if(mMappedMemory == nullptr || offset + size > mFrameEnd) return {vk::Buffer(nullptr), 0, 0, nullptr};
+
+	mCurrentOffset = offset + size;
+
+	return {mBuffer.mBuffer, offset, size, mMappedMemory + offset};
+}
@@ -0,0 +1,52 @@
+#ifndef THIEFVKRINGBUFFER_HPP
+#define THIEFVKRINGBUFFER_HPP
+
+#include <vulkan/vulkan.hpp>
+
+#include "ThiefVKMemoryManager.hpp"
+
+class ThiefVKDevice;
+
+// A slice of a ring buffer, only valid until the frame it was allocated in has finished on the GPU.
+struct ThiefVKRingAllocation {
+	vk::Buffer mBuffer;
+	uint64_t mOffset;
+	uint64_t mSize;
+	void* mMappedPointer;
+};
+
+
+// Linear allocator over one persistently mapped buffer. The buffer is split in to
+// a region per frame in flight and allocating is just bumping an offset in the
+// current frames region. A region is reset once the frame that last used it has
+// finished, so nothing is ever freed individually.
+class ThiefVKRingBuffer {
+public:
+	ThiefVKRingBuffer(ThiefVKDevice& Device, vk::BufferUsageFlags usage, uint64_t sizePerFrame, ThiefVKMemoryUsage memoryUsage = ThiefVKMemoryUsage::Upload);
+
+	void create(uint32_t framesInFlight); // releases the previous buffer if there is one
+	void destroy();
+
+	// Only call once the frameFinished fence for frameIndex has been waited on.
+	void beginFrame(uint32_t frameIndex);
+
+	// returns an allocation with a null buffer if the current frames region is full.
+	ThiefVKRingAllocation allocate(uint64_t size, uint64_t allignment);
+
+	vk::Buffer getBuffer() const { return mBuffer.mBuffer; }
+
+private:
+	ThiefVKDevice& mDevice;
+
+	vk::BufferUsageFlags mUsage;
+	uint64_t mSizePerFrame;
+	ThiefVKMemoryUsage mMemoryUsage;
+
+	ThiefVKBuffer mBuffer;
+	char* mMappedMemory;
+
+	uint64_t mCurrentOffset;
+	uint64_t mFrameEnd;
+};
+
+#endif
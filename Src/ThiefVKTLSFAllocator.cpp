@@ -0,0 +1,264 @@
+#include "ThiefVKTLSFAllocator.hpp"
+
+#include <cassert>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+    uint32_t lowestSetBit(uint64_t bits) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, bits);
+        return index;
+#else
+        return __builtin_ctzll(bits);
+#endif
+    }
+
+
+    uint32_t highestSetBit(uint64_t bits) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, bits);
+        return index;
+#else
+        return 63 - __builtin_clzll(bits);
+#endif
+    }
+
+}
+
+
+ThiefVKTLSFAllocator::ThiefVKTLSFAllocator() {
+    for(auto& firstLevel : mFreeLists) {
+        for(auto& list : firstLevel) {
+            list = kInvalidBlock;
+        }
+    }
+}
+
+
+ThiefVKTLSFAllocator::ThiefVKTLSFAllocator(uint64_t size) : ThiefVKTLSFAllocator() {
+    mSize = size;
+    mFreeSize = size;
+
+    const uint32_t block = createBlock();
+    mBlocks[block].offset = 0;
+    mBlocks[block].size   = size;
+    mBlocks[block].prevPhysical = kInvalidBlock;
+    mBlocks[block].nextPhysical = kInvalidBlock;
+
+    insertFreeBlock(block);
+}
+
+
+void ThiefVKTLSFAllocator::mapping(uint64_t size, uint32_t& firstLevel, uint32_t& secondLevel) {
+    if(size < (1ull << kFirstLevelShift)) {
+        firstLevel  = 0;
+        secondLevel = static_cast<uint32_t>(size);
+    } else {
+        const uint32_t log2Size = highestSetBit(size);
+        secondLevel = static_cast<uint32_t>(size >> (log2Size - kSecondLevelLog2)) ^ kSecondLevelCount;
+        firstLevel  = log2Size - kFirstLevelShift + 1;
+    }
+}
+
+
+// Round the size up to the next size class so that any block found in the
+// resulting list is guaranteed to be big enough.
+void ThiefVKTLSFAllocator::mappingSearch(uint64_t size, uint32_t& firstLevel, uint32_t& secondLevel) {
+    if(size >= (1ull << kFirstLevelShift)) {
+        const uint64_t round = (1ull << (highestSetBit(size) - kSecondLevelLog2)) - 1;
+        size += round;
+    }
+    mapping(size, firstLevel, secondLevel);
+}
+
+
+uint32_t ThiefVKTLSFAllocator::findSuitableBlock(uint32_t& firstLevel, uint32_t& secondLevel) const {
+    if(firstLevel >= kFirstLevelCount) return kInvalidBlock;
+
+    uint32_t secondLevelMap = mSecondLevelBitmaps[firstLevel] & (~0u << secondLevel);
+    if(secondLevelMap == 0) {
+        // nothing in this size class, look for the next biggest first level with a free block
+        const uint64_t firstLevelMap = firstLevel + 1 < 64 ? mFirstLevelBitmap & (~0ull << (firstLevel + 1)) : 0;
+        if(firstLevelMap == 0) return kInvalidBlock;
+
+        firstLevel = lowestSetBit(firstLevelMap);
+        secondLevelMap = mSecondLevelBitmaps[firstLevel];
+    }
+
+    secondLevel = lowestSetBit(secondLevelMap);
+    return mFreeLists[firstLevel][secondLevel];
+}
+
+
+void ThiefVKTLSFAllocator::insertFreeBlock(uint32_t block) {
+    uint32_t firstLevel, secondLevel;
+    mapping(mBlocks[block].size, firstLevel, secondLevel);
+
+    const uint32_t head = mFreeLists[firstLevel][secondLevel];
+    mBlocks[block].free     = true;
+    mBlocks[block].prevFree = kInvalidBlock;
+    mBlocks[block].nextFree = head;
+    if(head != kInvalidBlock) mBlocks[head].prevFree = block;
+
+    mFreeLists[firstLevel][secondLevel] = block;
+    ++mFreeBlockCount;
+    mFirstLevelBitmap |= 1ull << firstLevel;
+    mSecondLevelBitmaps[firstLevel] |= 1u << secondLevel;
+}
+
+
+void ThiefVKTLSFAllocator::removeFreeBlock(uint32_t block) {
+    uint32_t firstLevel, secondLevel;
+    mapping(mBlocks[block].size, firstLevel, secondLevel);
+
+    const uint32_t prev = mBlocks[block].prevFree;
+    const uint32_t next = mBlocks[block].nextFree;
+    if(prev != kInvalidBlock) mBlocks[prev].nextFree = next;
+    if(next != kInvalidBlock) mBlocks[next].prevFree = prev;
+
+    if(mFreeLists[firstLevel][secondLevel] == block) {
+        mFreeLists[firstLevel][secondLevel] = next;
+
+        if(next == kInvalidBlock) { // list is now empty so clear the bitmaps
+            mSecondLevelBitmaps[firstLevel] &= ~(1u << secondLevel);
+            if(mSecondLevelBitmaps[firstLevel] == 0) mFirstLevelBitmap &= ~(1ull << firstLevel);
+        }
+    }
+
+    mBlocks[block].free = false;
+    --mFreeBlockCount;
+}
+
+
+uint32_t ThiefVKTLSFAllocator::splitBlock(uint32_t block, uint64_t size) {
+    const uint32_t remainder = createBlock(); // may reallocate mBlocks so don't hold references over this
+
+    mBlocks[remainder].offset       = mBlocks[block].offset + size;
+    mBlocks[remainder].size         = mBlocks[block].size - size;
+    mBlocks[remainder].prevPhysical = block;
+    mBlocks[remainder].nextPhysical = mBlocks[block].nextPhysical;
+
+    if(mBlocks[block].nextPhysical != kInvalidBlock) mBlocks[mBlocks[block].nextPhysical].prevPhysical = remainder;
+
+    mBlocks[block].size = size;
+    mBlocks[block].nextPhysical = remainder;
+
+    return remainder;
+}
+
+
+// merge block with the physically next block, the next block must already
+// have been removed from the free lists.
+void ThiefVKTLSFAllocator::mergeWithNext(uint32_t block) {
+    const uint32_t next = mBlocks[block].nextPhysical;
+
+    mBlocks[block].size += mBlocks[next].size;
+    mBlocks[block].nextPhysical = mBlocks[next].nextPhysical;
+    if(mBlocks[next].nextPhysical != kInvalidBlock) mBlocks[mBlocks[next].nextPhysical].prevPhysical = block;
+
+    releaseBlock(next);
+}
+
+
+TLSFAllocation ThiefVKTLSFAllocator::allocate(uint64_t size, uint64_t allignment) {
+    if(size == 0 || allignment == 0) return {0, 0, kInvalidBlock};
+
+    // Search for a block that could fit the allocation with worst case allignment padding.
+    const uint64_t requiredSize = size + allignment - 1;
+    uint32_t firstLevel, secondLevel;
+    mappingSearch(requiredSize, firstLevel, secondLevel);
+
+    uint32_t block = findSuitableBlock(firstLevel, secondLevel);
+    if(block == kInvalidBlock) {
+        // Rounding up to the next size class skips blocks in the exact class that would still fit,
+        // e.g. a whole empty pool. Only the head of that list is checked so this stays O(1).
+        mapping(requiredSize, firstLevel, secondLevel);
+        if(firstLevel >= kFirstLevelCount || !(mSecondLevelBitmaps[firstLevel] & (1u << secondLevel))) return {0, 0, kInvalidBlock};
+
+        block = mFreeLists[firstLevel][secondLevel];
+        if(mBlocks[block].size < requiredSize) return {0, 0, kInvalidBlock};
+    }
+
+    removeFreeBlock(block);
+
+    uint32_t allocatedBlock = block;
+    const uint64_t padding = (allignment - (mBlocks[block].offset % allignment)) % allignment;
+    if(padding != 0) {
+        // keep the padding as it's own free block so it can be reclaimed when a neighbour is freed.
+        allocatedBlock = splitBlock(block, padding);
+        insertFreeBlock(block);
+    }
+
+    if(mBlocks[allocatedBlock].size > size) {
+        const uint32_t remainder = splitBlock(allocatedBlock, size);
+        insertFreeBlock(remainder);
+    }
+
+    mBlocks[allocatedBlock].free = false;
+    mFreeSize -= size;
+    ++mAllocationCount;
+
+    return {mBlocks[allocatedBlock].offset, size, allocatedBlock};
+}
+
+
+void ThiefVKTLSFAllocator::free(uint32_t block) {
+    assert(block < mBlocks.size() && !mBlocks[block].free);
+
+    mFreeSize += mBlocks[block].size;
+    --mAllocationCount;
+
+    const uint32_t next = mBlocks[block].nextPhysical;
+    if(next != kInvalidBlock && mBlocks[next].free) {
+        removeFreeBlock(next);
+        mergeWithNext(block);
+    }
+
+    const uint32_t prev = mBlocks[block].prevPhysical;
+    if(prev != kInvalidBlock && mBlocks[prev].free) {
+        removeFreeBlock(prev);
+        mergeWithNext(prev);
+        block = prev;
+    }
+
+    insertFreeBlock(block);
+}
+
+
+uint64_t ThiefVKTLSFAllocator::getLargestFreeBlock() const {
+    if(mFirstLevelBitmap == 0) return 0;
+
+    const uint32_t firstLevel  = highestSetBit(mFirstLevelBitmap);
+    const uint32_t secondLevel = highestSetBit(mSecondLevelBitmaps[firstLevel]);
+
+    uint64_t largest = 0;
+    for(uint32_t block = mFreeLists[firstLevel][secondLevel]; block != kInvalidBlock; block = mBlocks[block].nextFree) {
+        if(mBlocks[block].size > largest) largest = mBlocks[block].size;
+    }
+
+    return largest;
+}
+
+
+uint32_t ThiefVKTLSFAllocator::createBlock() {
+    if(!mUnusedBlocks.empty()) {
+        const uint32_t block = mUnusedBlocks.back();
+        mUnusedBlocks.pop_back();
+        return block;
+    }
+
+    mBlocks.push_back({});
+    return static_cast<uint32_t>(mBlocks.size() - 1);
+}
+
+
+void ThiefVKTLSFAllocator::releaseBlock(uint32_t block) {
+    mBlocks[block].free = false;
+    mUnusedBlocks.push_back(block);
+}
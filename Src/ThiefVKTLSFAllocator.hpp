@@ -0,0 +1,85 @@
+#ifndef THIEFVKTLSFALLOCATOR_HPP
+#define THIEFVKTLSFALLOCATOR_HPP
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+struct TLSFAllocation {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t block; // handle used to free the allocation without searching for it
+};
+
+// Two level segregated fit allocator, used to sub allocate ranges out of a larger block
+// of memory. It only deals in offsets so has no knowledge of vulkan, this lets it be
+// used for device memory, large shared buffers or anything else that needs carving up.
+// Free blocks are kept in lists indexed by size class with a bitmap per level so that
+// finding a block big enough and freeing (including merging with free neighbours) are O(1).
+// Requests are rounded up to the next size class so any listed block fits, the only other
+// block considered is the head of the requests own class, so allocate never walks a list.
+class ThiefVKTLSFAllocator {
+public:
+    static constexpr uint32_t kInvalidBlock = std::numeric_limits<uint32_t>::max();
+
+    ThiefVKTLSFAllocator(); // empty allocator that can't hand anything out
+    explicit ThiefVKTLSFAllocator(uint64_t size);
+
+    // returns an allocation with size 0 on failure
+    TLSFAllocation allocate(uint64_t size, uint64_t allignment);
+    void           free(uint32_t block);
+
+    uint64_t getSize() const { return mSize; }
+    uint64_t getFreeSize() const { return mFreeSize; }
+    bool     empty() const { return mFreeSize == mSize; }
+
+    uint32_t getAllocationCount() const { return mAllocationCount; }
+    uint32_t getFreeBlockCount() const { return mFreeBlockCount; }
+    uint64_t getLargestFreeBlock() const; // only has to search the biggest non empty size class
+
+private:
+    static constexpr uint32_t kSecondLevelLog2   = 5;
+    static constexpr uint32_t kSecondLevelCount  = 1 << kSecondLevelLog2;
+    static constexpr uint32_t kFirstLevelShift   = kSecondLevelLog2; // sizes smaller than this are mapped linearly in to the first list
+    static constexpr uint32_t kFirstLevelCount   = 64 - kFirstLevelShift + 1;
+
+    struct Block {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t prevPhysical;
+        uint32_t nextPhysical;
+        uint32_t prevFree;
+        uint32_t nextFree;
+        bool free;
+    };
+
+    static void mapping(uint64_t size, uint32_t& firstLevel, uint32_t& secondLevel);
+    static void mappingSearch(uint64_t size, uint32_t& firstLevel, uint32_t& secondLevel);
+
+    uint32_t findSuitableBlock(uint32_t& firstLevel, uint32_t& secondLevel) const;
+
+    void insertFreeBlock(uint32_t block);
+    void removeFreeBlock(uint32_t block);
+
+    uint32_t splitBlock(uint32_t block, uint64_t size); // returns the handle of the remainder
+    void     mergeWithNext(uint32_t block);
+
+    uint32_t createBlock();
+    void     releaseBlock(uint32_t block);
+
+    uint64_t mSize = 0;
+    uint64_t mFreeSize = 0;
+    uint32_t mAllocationCount = 0;
+    uint32_t mFreeBlockCount = 0;
+
+    // blocks are kept in one contiguous vector and refered to by index so we
+    // don't end up chasing pointers all over the heap.
+    std::vector<Block>    mBlocks;
+    std::vector<uint32_t> mUnusedBlocks;
+
+    uint64_t mFirstLevelBitmap = 0;
+    uint32_t mSecondLevelBitmaps[kFirstLevelCount] = {};
+    uint32_t mFreeLists[kFirstLevelCount][kSecondLevelCount] = {}; // only valid where the bitmaps are set
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include "ThiefVKTransferQueue.hpp"
+
+#include "ThiefVKDevice.hpp"
+
+#include <iostream>
+#include <limits>
+
+
+ThiefVKTransferQueue::ThiefVKTransferQueue(ThiefVKDevice& Device) :
+	mDevice{Device},
+	mEnabled{false},
+	mGetSemaphoreCounterValue{nullptr},
+	mRecording{0, vk::CommandBuffer(nullptr), {}},
+	mLastSubmittedValue{0} {}
+
+
+void ThiefVKTransferQueue::create(const QueueIndicies& queueIndices) {
+#ifdef VK_KHR_timeline_semaphore
+	if(queueIndices.TransferQueueIndex == -1 || !deviceSupportsExtension(*mDevice.getPhysicalDevice(), VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) return;
+
+	vk::Device& device = *mDevice.getLogicalDevice();
+
+	mGetSemaphoreCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(device.getProcAddr("vkGetSemaphoreCounterValueKHR"));
+	if(mGetSemaphoreCounterValue == nullptr) return;
+
+	mQueueFamilies = {static_cast<uint32_t>(queueIndices.TransferQueueIndex), static_cast<uint32_t>(queueIndices.GraphicsQueueIndex)};
+	mQueue = device.getQueue(queueIndices.TransferQueueIndex, 0);
+
+	vk::CommandPoolCreateInfo poolInfo{};
+	poolInfo.setQueueFamilyIndex(queueIndices.TransferQueueIndex);
+	poolInfo.setFlags(vk::CommandPoolCreateFlagBits::eTransient);
+	mCommandPool = device.createCommandPool(poolInfo);
+
+	vk::SemaphoreTypeCreateInfoKHR timelineInfo{};
+	timelineInfo.setSemaphoreType(vk::SemaphoreTypeKHR::eTimeline);
+	timelineInfo.setInitialValue(0);
+
+	vk::SemaphoreCreateInfo semInfo{};
+	semInfo.setPNext(&timelineInfo);
+	mTimeline = device.createSemaphore(semInfo);
+
+	mEnabled = true;
+
+#ifndef NDEBUG
+	std::cerr << "Uploading on transfer queue family " << queueIndices.TransferQueueIndex << '\n';
+#endif
+#endif
+}
+
+
+void ThiefVKTransferQueue::destroy() {
+	if(!mEnabled) return;
+
+	// the device is idle by now so every submission has finished.
+	collectFinished();
+	for(auto& stagingBuffer : mRecording.mStagingBuffers) {
+		mDevice.destroyBuffer(stagingBuffer);
+	}
+
+	vk::Device& device = *mDevice.getLogicalDevice();
+	device.destroySemaphore(mTimeline);
+	device.destroyCommandPool(mCommandPool);
+}
+
+
+void* ThiefVKTransferQueue::upload(const std::vector<ThiefVKUploadRegion>& regions) {
+	uint64_t size = 0;
+	for(const auto& region : regions) size += region.mSize;
+
+	ThiefVKBuffer stagingBuffer = mDevice.createBuffer(vk::BufferUsageFlagBits::eTransferSrc, size, ThiefVKMemoryUsage::Upload);
+	if(stagingBuffer.mBuffer == vk::Buffer(nullptr)) return nullptr;
+
+	if(mRecording.mCmdBuffer == vk::CommandBuffer(nullptr)) {
+		vk::CommandBufferAllocateInfo allocInfo{};
+		allocInfo.setCommandPool(mCommandPool);
+		allocInfo.setLevel(vk::CommandBufferLevel::ePrimary);
+		allocInfo.setCommandBufferCount(1);
+
+		mRecording.mCmdBuffer = mDevice.getLogicalDevice()->allocateCommandBuffers(allocInfo)[0];
+		mRecording.mValue = getRecordingValue();
+
+		vk::CommandBufferBeginInfo beginInfo{};
+		beginInfo.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+		mRecording.mCmdBuffer.begin(beginInfo);
+	}
+
+	uint64_t stagingOffset = stagingBuffer.mOffset;
+	for(const auto& region : regions) {
+		mRecording.mCmdBuffer.copyBuffer(stagingBuffer.mBuffer, region.mDst.mBuffer, vk::BufferCopy{stagingOffset, region.mDst.mOffset, region.mSize});
+		stagingOffset += region.mSize;
+	}
+	mRecording.mStagingBuffers.push_back(stagingBuffer);
+
+	return stagingBuffer.getMappedPointer();
+}
+
+
+void ThiefVKTransferQueue::submit() {
+#ifdef VK_KHR_timeline_semaphore
+	if(mRecording.mCmdBuffer == vk::CommandBuffer(nullptr)) return;
+
+	mRecording.mCmdBuffer.end();
+
+	// the semaphore signal makes the copies available, the frames that wait on it make them visible.
+	vk::TimelineSemaphoreSubmitInfoKHR timelineInfo{};
+	timelineInfo.setSignalSemaphoreValueCount(1);
+	timelineInfo.setPSignalSemaphoreValues(&mRecording.mValue);
+
+	vk::SubmitInfo submitInfo{};
+	submitInfo.setPNext(&timelineInfo);
+	submitInfo.setCommandBufferCount(1);
+	submitInfo.setPCommandBuffers(&mRecording.mCmdBuffer);
+	submitInfo.setSignalSemaphoreCount(1);
+	submitInfo.setPSignalSemaphores(&mTimeline);
+
+	mQueue.submit(submitInfo, nullptr);
+
+	mLastSubmittedValue = mRecording.mValue;
+	mInFlight.push_back(std::move(mRecording));
+	mRecording = Submission{0, vk::CommandBuffer(nullptr), {}};
+#endif
+}
+
+
+void ThiefVKTransferQueue::collectFinished() {
+	if(mInFlight.empty()) return;
+
+	const uint64_t completedValue = getCompletedValue();
+	while(!mInFlight.empty() && mInFlight.front().mValue <= completedValue) {
+		Submission& submission = mInFlight.front();
+
+		mDevice.getLogicalDevice()->freeCommandBuffers(mCommandPool, submission.mCmdBuffer);
+		for(auto& stagingBuffer : submission.mStagingBuffers) {
+			mDevice.destroyBuffer(stagingBuffer);
+		}
+
+		mInFlight.pop_front();
+	}
+}
+
+
+uint64_t ThiefVKTransferQueue::getCompletedValue() const {
+	if(!mEnabled) return std::numeric_limits<uint64_t>::max();
+
+	uint64_t value = 0;
+	mGetSemaphoreCounterValue(static_cast<VkDevice>(*mDevice.getLogicalDevice()), static_cast<VkSemaphore>(mTimeline), &value);
+
+	return value;
+}
@@ -0,0 +1,74 @@
+#ifndef THIEFVKTRANSFERQUEUE_HPP
+#define THIEFVKTRANSFERQUEUE_HPP
+
+#include <vulkan/vulkan.hpp>
+
+#include <deque>
+#include <vector>
+
+#include "ThiefVKInstance.hpp"
+#include "ThiefVKMemoryManager.hpp"
+
+class ThiefVKDevice;
+
+struct ThiefVKUploadRegion {
+	ThiefVKBuffer mDst;
+	uint64_t mSize;
+};
+
+// Records buffer uploads on a transfer only queue so they can overlap with rendering.
+// Each submission signals the next value of a timeline semaphore, and a frame only has
+// to wait on that value if it draws with the data that was uploaded.
+// Buffers that can be uploaded to are created with concurrent sharing between the
+// graphics and transfer families while this is enabled, so no ownership transfers are needed.
+class ThiefVKTransferQueue {
+public:
+	ThiefVKTransferQueue(ThiefVKDevice& Device);
+
+	// Falls back to being disabled if there is no transfer only queue family or no timeline
+	// semaphore support, uploads then need to be recorded on the graphics queue instead.
+	void create(const QueueIndicies& queueIndices);
+	void destroy();
+
+	bool isEnabled() const { return mEnabled; }
+	const std::vector<uint32_t>& getQueueFamilies() const { return mQueueFamilies; }
+
+	// Records a copy of each region in to its buffer from one block of staging memory and returns it to write the data to,
+	// laid out back to back in the order given, before the next submit. Either every region is recorded or, if no staging
+	// memory could be allocated, none are and nullptr is returned. getRecordingValue is signalled once they have landed.
+	void* upload(const std::vector<ThiefVKUploadRegion>& regions);
+	uint64_t getRecordingValue() const { return mLastSubmittedValue + 1; }
+
+	// Submits everything recorded since the last submit.
+	void submit();
+
+	// Frees the command buffers and staging memory of submissions that have finished.
+	void collectFinished();
+
+	uint64_t getCompletedValue() const;
+
+	vk::Semaphore getSemaphore() const { return mTimeline; }
+
+private:
+	struct Submission {
+		uint64_t mValue;
+		vk::CommandBuffer mCmdBuffer;
+		std::vector<ThiefVKBuffer> mStagingBuffers;
+	};
+
+	ThiefVKDevice& mDevice;
+	bool mEnabled;
+
+	std::vector<uint32_t> mQueueFamilies; // transfer then graphics
+	vk::Queue mQueue;
+	vk::CommandPool mCommandPool;
+
+	vk::Semaphore mTimeline;
+	PFN_vkGetSemaphoreCounterValueKHR mGetSemaphoreCounterValue;
+
+	Submission mRecording; // null command buffer until something is uploaded
+	uint64_t mLastSubmittedValue;
+	std::deque<Submission> mInFlight;
+};
+
+#endif
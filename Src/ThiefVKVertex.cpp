@@ -1,44 +1,235 @@
 #include "ThiefVKVertex.hpp"
 
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if COMPACT_VERTICES
+using PositionElement  = int16_t[4];
+using NormalElement    = int16_t[2];
+using AttributeElement = CompactVertexAttributes;
+#else
+using PositionElement  = glm::vec3;
+using NormalElement    = glm::vec3;
+using AttributeElement = VertexAttributes;
+#endif
+
 // Vertex member functions
-vk::VertexInputBindingDescription Vertex::getBindingDesc() {
+std::vector<vk::VertexInputBindingDescription> Vertex::getBindingDesc(const uint32_t streams) {
+    std::vector<vk::VertexInputBindingDescription> descs{};
+
+#if SPLIT_VERTEX_STREAMS
+    // bindings are fixed per stream so the same vertex buffer binds work for every pipeline.
+    const std::array<std::pair<uint32_t, uint32_t>, 3> streamStrides = {{{PositionStream, sizeof(PositionElement)}, 
+                                                                        {NormalStream, sizeof(NormalElement)}, 
+                                                                        {AttributeStream, sizeof(AttributeElement)}}};
+    for(uint32_t binding = 0; binding < streamStrides.size(); ++binding) {
+        if(!(streams & streamStrides[binding].first)) continue;
+
+        vk::VertexInputBindingDescription desc{};
+        desc.setStride(streamStrides[binding].second);
+        desc.setBinding(binding);
+        desc.setInputRate(vk::VertexInputRate::eVertex);
+
+        descs.push_back(desc);
+    }
+#else
+    static_cast<void>(streams); // every stream lives in the one interleaved binding.
 
     vk::VertexInputBindingDescription desc{};
-    desc.setStride(sizeof(Vertex));
+    desc.setStride(sizeof(MeshVertex));
     desc.setBinding(0);
     desc.setInputRate(vk::VertexInputRate::eVertex);
 
-    return desc;
+    descs.push_back(desc);
+#endif
+
+    return descs;
 }
 
-std::array<vk::VertexInputAttributeDescription, 4> Vertex::getAttribDesc() {
+std::vector<vk::VertexInputAttributeDescription> Vertex::getAttribDesc(const uint32_t streams) {
+#if SPLIT_VERTEX_STREAMS
+    const uint32_t posBinding = 0, normBinding = 1, attribBinding = 2;
+    const uint32_t posOffset = 0, normOffset = 0;
+    const uint32_t texOffset = offsetof(AttributeElement, tex), albedoOffset = offsetof(AttributeElement, albedo);
+#elif COMPACT_VERTICES
+    const uint32_t posBinding = 0, normBinding = 0, attribBinding = 0;
+    const uint32_t posOffset = offsetof(CompactVertex, pos), normOffset = offsetof(CompactVertex, norm);
+    const uint32_t texOffset    = offsetof(CompactVertex, attributes) + offsetof(CompactVertexAttributes, tex);
+    const uint32_t albedoOffset = offsetof(CompactVertex, attributes) + offsetof(CompactVertexAttributes, albedo);
+#else
+    const uint32_t posBinding = 0, normBinding = 0, attribBinding = 0;
+    const uint32_t posOffset = offsetof(Vertex, pos), normOffset = offsetof(Vertex, norm);
+    const uint32_t texOffset = offsetof(Vertex, tex), albedoOffset = offsetof(Vertex, albedo);
+#endif
+
+#if COMPACT_VERTICES
+    // the shaders still see floats, a 2 component normal means it needs to be octahedral decoded.
+    const vk::Format posFormat = vk::Format::eR16G16B16A16Snorm, normFormat = vk::Format::eR16G16Snorm;
+    const vk::Format texFormat = vk::Format::eR16G16Sfloat, albedoFormat = vk::Format::eR8Unorm;
+#else
+    const vk::Format posFormat = vk::Format::eR32G32B32Sfloat, normFormat = vk::Format::eR32G32B32Sfloat;
+    const vk::Format texFormat = vk::Format::eR32G32Sfloat, albedoFormat = vk::Format::eR32Sfloat;
+#endif
+    std::vector<vk::VertexInputAttributeDescription> descs{};
+
+    if(streams & PositionStream) {
+        vk::VertexInputAttributeDescription atribDescPos{};
+        atribDescPos.setBinding(posBinding);
+        atribDescPos.setLocation(0);
+        atribDescPos.setFormat(posFormat);
+        atribDescPos.setOffset(posOffset);
+
+        descs.push_back(atribDescPos);
+    }
+
+    if(streams & AttributeStream) {
+        vk::VertexInputAttributeDescription atribDescTex{};
+        atribDescTex.setBinding(attribBinding);
+        atribDescTex.setLocation(1);
+        atribDescTex.setFormat(texFormat);
+        atribDescTex.setOffset(texOffset);
+
+        descs.push_back(atribDescTex);
+    }
+
+    if(streams & NormalStream) {
+        vk::VertexInputAttributeDescription atribDescNormal{};
+        atribDescNormal.setBinding(normBinding);
+        atribDescNormal.setLocation(2);
+        atribDescNormal.setFormat(normFormat);
+        atribDescNormal.setOffset(normOffset);
+
+        descs.push_back(atribDescNormal);
+    }
+
+    if(streams & AttributeStream) {
+        vk::VertexInputAttributeDescription atribDescAlbedo{};
+        atribDescAlbedo.setBinding(attribBinding);
+        atribDescAlbedo.setLocation(3);
+        atribDescAlbedo.setFormat(albedoFormat);
+        atribDescAlbedo.setOffset(albedoOffset);
+
+        descs.push_back(atribDescAlbedo);
+    }
+
+	return descs;
+}
+
+
+uint64_t Vertex::getVertexDataSize(const uint64_t vertexCount) {
+#if SPLIT_VERTEX_STREAMS
+    return vertexCount * (sizeof(PositionElement) + sizeof(NormalElement) + sizeof(AttributeElement));
+#else
+    return vertexCount * sizeof(MeshVertex);
+#endif
+}
+
+
+std::array<vk::DeviceSize, kVertexBindingCount> Vertex::getBindingOffsets(const uint64_t vertexCount) {
+#if SPLIT_VERTEX_STREAMS
+    // the streams are stored one after the other in the same buffer.
+    return {0, vertexCount * sizeof(PositionElement), vertexCount * (sizeof(PositionElement) + sizeof(NormalElement))};
+#else
+    static_cast<void>(vertexCount);
+    return {0};
+#endif
+}
+
+
+void Vertex::writeVertexData(const std::vector<MeshVertex>& vertices, void* dst) {
+#if SPLIT_VERTEX_STREAMS
+    const std::array<vk::DeviceSize, kVertexBindingCount> offsets = getBindingOffsets(vertices.size());
+    char* positions  = static_cast<char*>(dst) + offsets[0];
+    char* normals    = static_cast<char*>(dst) + offsets[1];
+    char* attributes = static_cast<char*>(dst) + offsets[2];
+
+    for(uint64_t i = 0; i < vertices.size(); ++i) {
+#if COMPACT_VERTICES
+        std::memcpy(positions + i * sizeof(PositionElement), vertices[i].pos, sizeof(PositionElement));
+        std::memcpy(normals + i * sizeof(NormalElement), vertices[i].norm, sizeof(NormalElement));
+        std::memcpy(attributes + i * sizeof(AttributeElement), &vertices[i].attributes, sizeof(AttributeElement));
+#else
+        const VertexAttributes vertexAttributes{vertices[i].tex, vertices[i].albedo};
+        std::memcpy(positions + i * sizeof(PositionElement), &vertices[i].pos, sizeof(PositionElement));
+        std::memcpy(normals + i * sizeof(NormalElement), &vertices[i].norm, sizeof(NormalElement));
+        std::memcpy(attributes + i * sizeof(AttributeElement), &vertexAttributes, sizeof(AttributeElement));
+#endif
+    }
+#else
+    std::memcpy(dst, vertices.data(), vertices.size() * sizeof(MeshVertex));
+#endif
+}
+
+
+#if COMPACT_VERTICES
+namespace {
+
+// Maps a unit vector on to the octahedron and unfolds it in to a square, decoded in the vertex shaders.
+glm::vec2 octahedralEncode(glm::vec3 normal) {
+    const float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if(length == 0.0f) return glm::vec2(0.0f);
+
+    normal /= length;
+    if(normal.z >= 0.0f) return glm::vec2(normal.x, normal.y);
+
+    return glm::vec2((1.0f - std::abs(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f),
+                     (1.0f - std::abs(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f));
+}
+
+}
+#endif
+
+
+std::vector<MeshVertex> packVertices(std::vector<Vertex>&& vertices, glm::vec4& positionOffsetAndScale) {
+    positionOffsetAndScale = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+#if COMPACT_VERTICES
+    if(vertices.empty()) return {};
+
+    glm::vec3 minBound = vertices[0].pos;
+    glm::vec3 maxBound = vertices[0].pos;
+    for(const auto& vertex : vertices) {
+        minBound = glm::min(minBound, vertex.pos);
+        maxBound = glm::max(maxBound, vertex.pos);
+    }
+
+    // one scale for all axis so the object matrix can still be used for the normals.
+    const glm::vec3 centre = (minBound + maxBound) * 0.5f;
+    const glm::vec3 extent = (maxBound - minBound) * 0.5f;
+    const float scale = std::max({extent.x, extent.y, extent.z, 1e-6f});
+    positionOffsetAndScale = glm::vec4(centre, scale);
 
-    vk::VertexInputAttributeDescription atribDescPos{};
-    atribDescPos.setBinding(0);
-    atribDescPos.setLocation(0);
-    atribDescPos.setFormat(vk::Format::eR32G32B32Sfloat);
-    atribDescPos.setOffset(offsetof(Vertex, pos));
+    std::vector<CompactVertex> compactVertices(vertices.size());
+    for(uint64_t i = 0; i < vertices.size(); ++i) {
+        const Vertex& vertex = vertices[i];
+        CompactVertex& compactVertex = compactVertices[i];
 
+        const glm::vec3 position = (vertex.pos - centre) / scale;
+        for(uint32_t axis = 0; axis < 3; ++axis) {
+            compactVertex.pos[axis] = static_cast<int16_t>(glm::packSnorm1x16(position[axis]));
+        }
+        compactVertex.pos[3] = 0;
 
-    vk::VertexInputAttributeDescription atribDescTex{};
-    atribDescTex.setBinding(0);
-	atribDescTex.setLocation(1);
-    atribDescTex.setFormat(vk::Format::eR32G32Sfloat);
-    atribDescTex.setOffset(offsetof(Vertex, tex));
+        const glm::vec2 normal = octahedralEncode(vertex.norm);
+        compactVertex.norm[0] = static_cast<int16_t>(glm::packSnorm1x16(normal.x));
+        compactVertex.norm[1] = static_cast<int16_t>(glm::packSnorm1x16(normal.y));
 
-	vk::VertexInputAttributeDescription atribDescNormal{};
-	atribDescNormal.setBinding(0);
-	atribDescNormal.setLocation(2);
-	atribDescNormal.setFormat(vk::Format::eR32G32B32Sfloat);
-	atribDescNormal.setOffset(offsetof(Vertex, norm));
+        compactVertex.attributes.tex[0] = glm::packHalf1x16(vertex.tex.x);
+        compactVertex.attributes.tex[1] = glm::packHalf1x16(vertex.tex.y);
+        compactVertex.attributes.albedo = static_cast<uint8_t>(glm::packUnorm1x8(vertex.albedo));
+        compactVertex.attributes.padding[0] = compactVertex.attributes.padding[1] = compactVertex.attributes.padding[2] = 0;
+    }
 
-    vk::VertexInputAttributeDescription atribDescAlbedo{};
-    atribDescAlbedo.setBinding(0);
-    atribDescAlbedo.setLocation(3);
-    atribDescAlbedo.setFormat(vk::Format::eR32Sfloat);
-    atribDescAlbedo.setOffset(offsetof(Vertex, albedo));
+    vertices.clear();
+    vertices.shrink_to_fit();
 
-	return {atribDescPos, atribDescTex, atribDescNormal, atribDescAlbedo};
+    return compactVertices;
+#else
+    return std::move(vertices);
+#endif
 }
 
 
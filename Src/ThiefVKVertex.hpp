@@ -7,6 +7,41 @@
 #include <glm/gtx/hash.hpp>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include <array>
+#include <vector>
+
+// Store vertices as a position, normal and attribute stream instead of interleaved,
+// so each subpass only fetches the attributes it actually uses.
+#define SPLIT_VERTEX_STREAMS 0
+
+// The attributes a pipeline reads, one binding each when the streams are split.
+enum VertexStreams : uint32_t {
+	PositionStream  = 1,
+	NormalStream    = 2,
+	AttributeStream = 4, // texture coordinates and albedo
+	AllStreams      = PositionStream | NormalStream | AttributeStream
+};
+
+#if SPLIT_VERTEX_STREAMS
+constexpr uint32_t kVertexBindingCount = 3;
+#else
+constexpr uint32_t kVertexBindingCount = 1;
+#endif
+
+// Quantize vertices when a mesh is loaded, see CompactVertex.
+#define COMPACT_VERTICES 0
+
+struct Vertex;
+struct CompactVertex;
+
+// The format vertices are kept in once they've been loaded.
+#if COMPACT_VERTICES
+using MeshVertex = CompactVertex;
+#else
+using MeshVertex = Vertex;
+#endif
 
 struct Vertex { // vertex struct representing vertex positions and texture coordinates
 	glm::vec3 pos;
@@ -14,12 +49,45 @@ struct Vertex { // vertex struct representing vertex positions and texture coord
 	glm::vec2 tex;
 	float	  albedo;
 
-    static vk::VertexInputBindingDescription getBindingDesc();
+    static std::vector<vk::VertexInputBindingDescription> getBindingDesc(const uint32_t streams = AllStreams);
+
+	static std::vector<vk::VertexInputAttributeDescription> getAttribDesc(const uint32_t streams = AllStreams);
+
+	// Size and layout of the vertices once they're in a vertex buffer.
+	static uint64_t getVertexDataSize(const uint64_t vertexCount);
+	static std::array<vk::DeviceSize, kVertexBindingCount> getBindingOffsets(const uint64_t vertexCount);
+	static void writeVertexData(const std::vector<MeshVertex>& vertices, void* dst);
+};
+
+
+// What's left of a Vertex after the position and normal, the attribute stream is made of these.
+struct VertexAttributes {
+	glm::vec2 tex;
+	float	  albedo;
+};
+
+
+struct CompactVertexAttributes {
+	uint16_t tex[2];	// half floats
+	uint8_t  albedo;	// unorm
+	uint8_t  padding[3];
+};
+
 
-	static std::array<vk::VertexInputAttributeDescription, 4> getAttribDesc();
+// 20 bytes instead of 36. Positions are snorm relative to the meshes bounds (the bounds
+// get folded in to the object matrix) and normals are octahedral encoded.
+struct CompactVertex {
+	int16_t pos[4]; // w is padding, 3 component 16 bit formats are barely supported
+	int16_t norm[2];
+	CompactVertexAttributes attributes;
 };
 
 
+// Converts loaded vertices in to the format they're kept in. positionOffsetAndScale is
+// set to the bounds compact positions are relative to, otherwise it's left as the identity.
+std::vector<MeshVertex> packVertices(std::vector<Vertex>&& vertices, glm::vec4& positionOffsetAndScale);
+
+
 bool operator==(const Vertex& lhs, const Vertex& rhs);
 
 bool operator<(const Vertex& lhs, const Vertex& rhs);